@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define CAPACITY       (64 * 1024)      // size-based flush threshold (bytes)
+#define TIMEOUT        100e-6           // time-based flush threshold (seconds)
+#define PROGRESS_EVERY 64               // messages between two progress calls
+#define AGG_TAG        10               // tag of the batches
+#define RAW_TAG        11               // tag of the raw messages (benchmark)
+
+#define COUNT      100000               // messages per process and length
+#define WINDOW     64                   // raw messages in flight
+#define MIN_LENGTH 1                    // smallest message of a sweep (bytes)
+#define MAX_LENGTH 4096                 // largest message of a sweep (bytes)
+
+
+// Message aggregation: small logical messages to the same destination are
+// appended to a batch ([int length][payload] frames), and a batch is sent
+// as one MPI message when it would exceed "capacity" bytes or when its
+// oldest message has waited "timeout" seconds. Received batches are split
+// back and every message is given to a handler. The handler must not send
+// through the aggregator.
+
+typedef void (*handler_t)(int source, char* data, int length, void* context);
+
+// per destination state: the batch being filled and the one being sent
+struct destination {
+    char*       buffer;
+    int         allocated;
+    int         fill;
+    double      oldest;                 // arrival of the batch's first message
+    char*       sending;
+    int         sending_allocated;
+    MPI_Request request;                // send of "sending"
+    long        batches;                // batches sent to this destination
+};
+
+struct aggregator {
+    MPI_Comm            comm;
+    int                 rank;
+    int                 size;
+    int                 capacity;
+    double              timeout;
+    handler_t           handler;
+    void*               context;
+    struct destination* destinations;
+    char*               incoming;       // receive buffer of the batches
+    int                 incoming_allocated;
+    long                received;       // batches received
+    int                 pending;        // messages since the last progress
+};
+
+
+// aggregator_init function: prepare an aggregator over "comm"
+void aggregator_init(struct aggregator* agg, MPI_Comm comm, int capacity,
+                     double timeout, handler_t handler, void* context) {
+    agg->comm     = comm;
+    agg->capacity = capacity;
+    agg->timeout  = timeout;
+    agg->handler  = handler;
+    agg->context  = context;
+    agg->received = 0;
+    agg->pending  = 0;
+    MPI_Comm_rank(comm, &agg->rank);
+    MPI_Comm_size(comm, &agg->size);
+
+    agg->destinations = malloc(agg->size * sizeof(struct destination));
+    for(int d = 0; d < agg->size; d++) {
+        struct destination* dest = &agg->destinations[d];
+        dest->buffer    = malloc(capacity);
+        dest->allocated = capacity;
+        dest->fill      = 0;
+        dest->oldest    = 0.;
+        dest->sending   = malloc(capacity);
+        dest->sending_allocated = capacity;
+        dest->request   = MPI_REQUEST_NULL;
+        dest->batches   = 0;
+    }
+    agg->incoming           = malloc(capacity);
+    agg->incoming_allocated = capacity;
+}
+
+
+// deliver function: give every message of a batch to the handler
+void deliver(struct aggregator* agg, int source, char* batch, int bytes) {
+    int position = 0;
+
+    while(position < bytes) {
+        int length;
+        memcpy(&length, batch + position, sizeof(int));
+        position += sizeof(int);
+        agg->handler(source, batch + position, length, agg->context);
+        position += length;
+    }
+}
+
+
+// aggregator_poll function: receive and deliver every batch already
+// arrived, return their number
+int aggregator_poll(struct aggregator* agg) {
+    MPI_Status status;
+    int        flag, bytes, batches = 0;
+
+    while(1) {
+        MPI_Iprobe(MPI_ANY_SOURCE, AGG_TAG, agg->comm, &flag, &status);
+        if(!flag)
+            return batches;
+        MPI_Get_count(&status, MPI_BYTE, &bytes);
+        if(bytes > agg->incoming_allocated) {
+            agg->incoming           = realloc(agg->incoming, bytes);
+            agg->incoming_allocated = bytes;
+        }
+        MPI_Recv(agg->incoming, bytes, MPI_BYTE, status.MPI_SOURCE, AGG_TAG,
+                 agg->comm, MPI_STATUS_IGNORE);
+        deliver(agg, status.MPI_SOURCE, agg->incoming, bytes);
+        agg->received++;
+        batches++;
+    }
+}
+
+
+// wait_send function: wait for the send of a batch, receiving meanwhile,
+// as the destination may itself be waiting for one of our receives
+void wait_send(struct aggregator* agg, MPI_Request* request) {
+    int done;
+
+    MPI_Test(request, &done, MPI_STATUS_IGNORE);
+    while(!done) {
+        aggregator_poll(agg);
+        MPI_Test(request, &done, MPI_STATUS_IGNORE);
+    }
+}
+
+
+// aggregator_flush function: send the batch of destination "d" (a batch
+// for the process itself is delivered at once)
+void aggregator_flush(struct aggregator* agg, int d) {
+    struct destination* dest = &agg->destinations[d];
+
+    if(dest->fill == 0)
+        return;
+    if(d == agg->rank) {
+        deliver(agg, d, dest->buffer, dest->fill);
+        dest->fill = 0;
+        return;
+    }
+
+    wait_send(agg, &dest->request);
+    char* batch            = dest->buffer;
+    int   allocated        = dest->allocated;
+    dest->buffer           = dest->sending;
+    dest->allocated        = dest->sending_allocated;
+    dest->sending          = batch;
+    dest->sending_allocated = allocated;
+    MPI_Isend(dest->sending, dest->fill, MPI_BYTE, d, AGG_TAG, agg->comm,
+              &dest->request);
+    dest->batches++;
+    dest->fill = 0;
+}
+
+
+// aggregator_progress function: flush the batches waiting for too long and
+// deliver the arrived ones
+void aggregator_progress(struct aggregator* agg) {
+    double now = MPI_Wtime();
+
+    for(int d = 0; d < agg->size; d++) {
+        struct destination* dest = &agg->destinations[d];
+        if(dest->fill > 0 && now - dest->oldest >= agg->timeout)
+            aggregator_flush(agg, d);
+    }
+    aggregator_poll(agg);
+    agg->pending = 0;
+}
+
+
+// aggregator_send function: append a message of "length" bytes for
+// destination "d". A message larger than the capacity gets a batch of its
+// own.
+void aggregator_send(struct aggregator* agg, int d, void* data, int length) {
+    struct destination* dest  = &agg->destinations[d];
+    int                 frame = sizeof(int) + length;
+
+    if(dest->fill > 0 && dest->fill + frame > agg->capacity)
+        aggregator_flush(agg, d);
+    if(dest->fill + frame > dest->allocated) {
+        dest->buffer    = realloc(dest->buffer, dest->fill + frame);
+        dest->allocated = dest->fill + frame;
+    }
+    if(dest->fill == 0)
+        dest->oldest = MPI_Wtime();
+    memcpy(dest->buffer + dest->fill, &length, sizeof(int));
+    memcpy(dest->buffer + dest->fill + sizeof(int), data, length);
+    dest->fill += frame;
+    if(dest->fill >= agg->capacity)
+        aggregator_flush(agg, d);
+
+    if(++agg->pending == PROGRESS_EVERY)
+        aggregator_progress(agg);
+}
+
+
+// aggregator_finish function: flush everything and deliver every message
+// sent to this process (collective: processes exchange their numbers of
+// batches to know how many to wait for). The exchange is non-blocking, as a
+// process still flushing may be waiting for one of our receives.
+void aggregator_finish(struct aggregator* agg) {
+    long*       sent     = malloc(agg->size * sizeof(long));
+    long*       expected = malloc(agg->size * sizeof(long));
+    long        total    = 0;
+    MPI_Request request;
+    int         done;
+
+    for(int d = 0; d < agg->size; d++) {
+        aggregator_flush(agg, d);
+        sent[d] = agg->destinations[d].batches;
+    }
+    MPI_Ialltoall(sent, 1, MPI_LONG, expected, 1, MPI_LONG, agg->comm,
+                  &request);
+    MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    while(!done) {
+        aggregator_poll(agg);
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    }
+    for(int s = 0; s < agg->size; s++)
+        total += expected[s];
+
+    while(agg->received < total)
+        aggregator_poll(agg);
+    for(int d = 0; d < agg->size; d++) {
+        MPI_Wait(&agg->destinations[d].request, MPI_STATUS_IGNORE);
+        agg->destinations[d].batches = 0;
+    }
+    agg->received = 0;
+
+    free(sent);
+    free(expected);
+}
+
+
+// aggregator_free function: release an aggregator (after aggregator_finish)
+void aggregator_free(struct aggregator* agg) {
+    for(int d = 0; d < agg->size; d++) {
+        free(agg->destinations[d].buffer);
+        free(agg->destinations[d].sending);
+    }
+    free(agg->destinations);
+    free(agg->incoming);
+}
+
+
+// Benchmark: every process sends "count" messages of "length" bytes,
+// round-robin over the other processes (with two processes, a stream in
+// each direction), either one MPI message each or through an aggregator.
+
+// received messages and bytes of the benchmark
+struct tally {
+    long messages;
+    long bytes;
+};
+
+
+void count_message(int source, char* data, int length, void* context) {
+    struct tally* tally = context;
+
+    (void) source;
+    (void) data;
+    tally->messages++;
+    tally->bytes += length;
+}
+
+
+// destination of the i-th message of "rank": every process receives the
+// same number of messages in any range of i
+int destination(int rank, int size, int i) {
+    return (rank + 1 + i % (size - 1)) % size;
+}
+
+
+// raw function: send the messages one by one, in windows of WINDOW sends
+// matched by WINDOW receives from any process, and return the time of the
+// slowest process
+double raw(int length, int count, char* message, char* window_buffer,
+           MPI_Comm comm) {
+    MPI_Request requests[2 * WINDOW];
+    int         rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    MPI_Barrier(comm);
+    double t = MPI_Wtime();
+    for(int i = 0; i < count; i += WINDOW) {
+        int window = count - i < WINDOW ? count - i : WINDOW;
+        for(int w = 0; w < window; w++)
+            MPI_Irecv(window_buffer + (size_t) w * length, length, MPI_CHAR,
+                      MPI_ANY_SOURCE, RAW_TAG, comm, &requests[w]);
+        for(int w = 0; w < window; w++)
+            MPI_Isend(message, length, MPI_CHAR,
+                      destination(rank, size, i + w), RAW_TAG, comm,
+                      &requests[window + w]);
+        MPI_Waitall(2 * window, requests, MPI_STATUSES_IGNORE);
+    }
+    t = MPI_Wtime() - t;
+    MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+    return t;
+}
+
+
+// aggregated function: send the messages through an aggregator and return
+// the time of the slowest process. Every process checks that it received
+// all its messages.
+double aggregated(int length, int count, char* message, int capacity,
+                  double timeout, int* valid, MPI_Comm comm) {
+    struct aggregator agg;
+    struct tally      tally = {0, 0};
+    int               rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    aggregator_init(&agg, comm, capacity, timeout, count_message, &tally);
+
+    MPI_Barrier(comm);
+    double t = MPI_Wtime();
+    for(int i = 0; i < count; i++)
+        aggregator_send(&agg, destination(rank, size, i), message, length);
+    aggregator_finish(&agg);
+    t = MPI_Wtime() - t;
+    MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+    *valid = tally.messages == count && tally.bytes == (long) count * length;
+    MPI_Allreduce(MPI_IN_PLACE, valid, 1, MPI_INT, MPI_LAND, comm);
+    aggregator_free(&agg);
+
+    return t;
+}
+
+
+int main(int argc, char** argv) {
+    int    rank, size, opt;
+    int    count = COUNT, capacity = CAPACITY;
+    int    min_length = MIN_LENGTH, max_length = MAX_LENGTH;
+    double timeout = TIMEOUT, factor = 2.;
+    int    error = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    while((opt = getopt(argc, argv, "c:b:T:s:S:f:")) != -1) {
+        switch(opt) {
+        case 'c': count = atoi(optarg); break;
+        case 'b': capacity = atoi(optarg); break;
+        case 'T': timeout = 1e-6 * atof(optarg); break;
+        case 's': min_length = atoi(optarg); break;
+        case 'S': max_length = atoi(optarg); break;
+        case 'f': factor = atof(optarg); break;
+        default:
+            error = 1;
+        }
+    }
+
+    if(error || optind != argc || size < 2 || count <= 0 || capacity <= 0 ||
+       timeout < 0. || min_length <= 0 || max_length < min_length ||
+       factor <= 1.) {
+        if(rank == 0)
+            fprintf(stderr, "Usage: %s [-c messages] [-b batch-bytes] "
+                            "[-T timeout-us] [-s min-length]\n"
+                            "          [-S max-length] [-f factor] "
+                            "(at least two processes)\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // rates are per process (messages sent per second)
+    if(rank == 0)
+        printf("message_len,messages,raw_time,raw_rate,raw_throughput,"
+               "agg_time,agg_rate,agg_throughput,speedup,valid\n");
+
+    double l = min_length;
+    while(l <= max_length) {
+        int   length        = (int) l;
+        char* message       = calloc(length, 1);
+        char* window_buffer = malloc((size_t) WINDOW * length);
+        int   valid;
+
+        double raw_time = raw(length, count, message, window_buffer,
+                              MPI_COMM_WORLD);
+        double agg_time = aggregated(length, count, message, capacity, timeout,
+                                     &valid, MPI_COMM_WORLD);
+        if(rank == 0) {
+            printf("%d,%d,%lf,%lf,%lf,%lf,%lf,%lf,%.2lf,%s\n", length, count,
+                   raw_time, count / raw_time,
+                   (double) count * length / (1024. * 1024. * raw_time),
+                   agg_time, count / agg_time,
+                   (double) count * length / (1024. * 1024. * agg_time),
+                   raw_time / agg_time, valid ? "yes" : "no");
+            fflush(stdout);
+        }
+        free(message);
+        free(window_buffer);
+
+        l *= factor;
+        if((int) l == length)
+            l = length + 1;
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,493 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define ITERATIONS 200                  // timed calls per message size
+#define WARMUP     20                   // untimed calls per message size
+#define MIN_LENGTH 1                    // smallest block of a sweep (bytes)
+#define MAX_LENGTH (1024 * 1024)        // largest block of a sweep (bytes)
+#define MIN_RANKS  2                    // smallest communicator of a sweep
+#define TAG        7                    // tag of the hand-rolled collectives
+
+// collective operations
+#define BARRIER   0
+#define BCAST     1
+#define SCATTER   2
+#define SCATTERV  3
+#define GATHER    4
+#define ALLREDUCE 5
+#define ALLTOALL  6
+#define ALLTOALLV 7
+#define NB_OPS    8
+
+const char* op_names[NB_OPS] = {"barrier", "bcast", "scatter", "scatterv",
+                                "gather", "allreduce", "alltoall", "alltoallv"};
+
+
+// buffers and data layouts of one measurement. Layouts are prefix offsets
+// with size + 1 entries (the blocks of the ranks are packed in rank order).
+struct buffers {
+    char* send;
+    char* recv;
+    char* scratch;                      // subtrees of the hand-rolled versions
+    char* reference;                    // result of MPI's version (validation)
+    int*  block_displs;                 // uniform blocks of "length" bytes
+    int*  v_counts;                     // scatterv blocks
+    int*  v_displs;
+    int*  a2a_counts;                   // alltoallv blocks (symmetric)
+    int*  a2a_displs;
+};
+
+
+// compare function: compare two double values, in a way compatible with
+// C's library qsort function
+int compare(const void* p1, const void* p2) {
+    double v1 = *(const double*) p1;
+    double v2 = *(const double*) p2;
+
+    return (v1 > v2) - (v1 < v2);
+}
+
+
+// p99_index function: index of the 99th percentile of "n" sorted values,
+// never below the median one (n / 2), which it could be for small n
+int p99_index(int n) {
+    int index = (int) (0.99 * (n - 1));
+
+    return index < n / 2 ? n / 2 : index;
+}
+
+
+int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+
+// v_count function: bytes sent from rank i to rank j by the irregular
+// operations, between half and one and a half "length"
+int v_count(int i, int j, int length) {
+    return length / 2 + length * ((i + j) % 3) / 2;
+}
+
+
+// The hand-rolled collectives below all use root 0. In the binomial tree,
+// the parent of a rank is the rank without its lowest set bit, and the
+// subtree of a rank with lowest set bit "mask" is [rank, rank + mask) (the
+// root's subtree is the whole communicator).
+
+
+// tree_bcast function: broadcast "length" bytes of "buffer" from rank 0
+void tree_bcast(char* buffer, int length, MPI_Comm comm) {
+    int rank, size, mask = 1;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    while(mask < size) {
+        if(rank & mask) {
+            MPI_Recv(buffer, length, MPI_BYTE, rank - mask, TAG, comm,
+                     MPI_STATUS_IGNORE);
+            break;
+        }
+        mask <<= 1;
+    }
+    // largest subtree first
+    for(mask >>= 1; mask > 0; mask >>= 1)
+        if(rank + mask < size)
+            MPI_Send(buffer, length, MPI_BYTE, rank + mask, TAG, comm);
+}
+
+
+// tree_scatterv function: rank r receives in "recv" the bytes
+// [displs[r], displs[r + 1]) of rank 0's "send". Every rank receives the
+// blocks of its whole subtree in "scratch" and forwards those of its
+// children.
+void tree_scatterv(char* send, int* displs, char* recv, char* scratch,
+                   MPI_Comm comm) {
+    int rank, size, mask = 1;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    char* subtree = rank == 0 ? send : scratch;
+
+    while(mask < size) {
+        if(rank & mask) {
+            int last = min(rank + mask, size);
+            MPI_Recv(scratch, displs[last] - displs[rank], MPI_BYTE,
+                     rank - mask, TAG, comm, MPI_STATUS_IGNORE);
+            break;
+        }
+        mask <<= 1;
+    }
+    for(mask >>= 1; mask > 0; mask >>= 1) {
+        int child = rank + mask;
+        if(child < size) {
+            int last = min(child + mask, size);
+            MPI_Send(subtree + displs[child] - displs[rank],
+                     displs[last] - displs[child], MPI_BYTE, child, TAG, comm);
+        }
+    }
+    memcpy(recv, subtree, displs[rank + 1] - displs[rank]);
+}
+
+
+// tree_gatherv function: the reverse of tree_scatterv, rank 0 receives in
+// "recv" the block of rank r at displs[r]
+void tree_gatherv(char* send, int* displs, char* recv, char* scratch,
+                  MPI_Comm comm) {
+    int rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    char* subtree = rank == 0 ? recv : scratch;
+
+    memcpy(subtree, send, displs[rank + 1] - displs[rank]);
+    for(int mask = 1; mask < size; mask <<= 1) {
+        if(rank & mask) {
+            int last = min(rank + mask, size);
+            MPI_Send(subtree, displs[last] - displs[rank], MPI_BYTE,
+                     rank - mask, TAG, comm);
+            break;
+        }
+        int child = rank + mask;
+        if(child < size) {
+            int last = min(child + mask, size);
+            MPI_Recv(subtree + displs[child] - displs[rank],
+                     displs[last] - displs[child], MPI_BYTE, child, TAG, comm,
+                     MPI_STATUS_IGNORE);
+        }
+    }
+}
+
+
+// tree_allreduce function: sum "count" unsigned values of every rank,
+// with a binomial reduction to rank 0 followed by a binomial broadcast
+void tree_allreduce(unsigned* send, unsigned* recv, unsigned* scratch,
+                    int count, MPI_Comm comm) {
+    int rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    memcpy(recv, send, count * sizeof(unsigned));
+    for(int mask = 1; mask < size; mask <<= 1) {
+        if(rank & mask) {
+            MPI_Send(recv, count, MPI_UNSIGNED, rank - mask, TAG, comm);
+            break;
+        }
+        if(rank + mask < size) {
+            MPI_Recv(scratch, count, MPI_UNSIGNED, rank + mask, TAG, comm,
+                     MPI_STATUS_IGNORE);
+            for(int i = 0; i < count; i++)
+                recv[i] += scratch[i];
+        }
+    }
+    tree_bcast((char*) recv, count * sizeof(unsigned), comm);
+}
+
+
+// tree_barrier function: empty messages up the binomial tree, then down
+void tree_barrier(MPI_Comm comm) {
+    int rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    for(int mask = 1; mask < size; mask <<= 1) {
+        if(rank & mask) {
+            MPI_Send(NULL, 0, MPI_BYTE, rank - mask, TAG, comm);
+            break;
+        }
+        if(rank + mask < size)
+            MPI_Recv(NULL, 0, MPI_BYTE, rank + mask, TAG, comm,
+                     MPI_STATUS_IGNORE);
+    }
+    tree_bcast(NULL, 0, comm);
+}
+
+
+// pairwise_alltoallv function: at step k, every rank r sends its block for
+// rank r + k and receives the one of rank r - k. There is no tree version
+// of the personalised all-to-all worth having: every byte crosses the
+// network once this way.
+void pairwise_alltoallv(char* send, int* send_displs, char* recv,
+                        int* recv_displs, MPI_Comm comm) {
+    int rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    memcpy(recv + recv_displs[rank], send + send_displs[rank],
+           send_displs[rank + 1] - send_displs[rank]);
+    for(int k = 1; k < size; k++) {
+        int dest   = (rank + k) % size;
+        int source = (rank - k + size) % size;
+        MPI_Sendrecv(send + send_displs[dest],
+                     send_displs[dest + 1] - send_displs[dest], MPI_BYTE, dest,
+                     TAG, recv + recv_displs[source],
+                     recv_displs[source + 1] - recv_displs[source], MPI_BYTE,
+                     source, TAG, comm, MPI_STATUS_IGNORE);
+    }
+}
+
+
+// collective function: one call of operation "op" on blocks of "length"
+// bytes, with MPI's implementation or the hand-rolled one ("hand")
+void collective(int op, int hand, int length, struct buffers* b,
+                MPI_Comm comm) {
+    int rank;
+    int count = length / (int) sizeof(unsigned) > 0 ?
+                length / (int) sizeof(unsigned) : 1;
+
+    MPI_Comm_rank(comm, &rank);
+
+    switch(op) {
+    case BARRIER:
+        if(hand)
+            tree_barrier(comm);
+        else
+            MPI_Barrier(comm);
+        break;
+    case BCAST:
+        if(hand)
+            tree_bcast(b->recv, length, comm);
+        else
+            MPI_Bcast(b->recv, length, MPI_BYTE, 0, comm);
+        break;
+    case SCATTER:
+        if(hand)
+            tree_scatterv(b->send, b->block_displs, b->recv, b->scratch, comm);
+        else
+            MPI_Scatter(b->send, length, MPI_BYTE, b->recv, length, MPI_BYTE,
+                        0, comm);
+        break;
+    case SCATTERV:
+        if(hand)
+            tree_scatterv(b->send, b->v_displs, b->recv, b->scratch, comm);
+        else
+            MPI_Scatterv(b->send, b->v_counts, b->v_displs, MPI_BYTE, b->recv,
+                         b->v_counts[rank], MPI_BYTE, 0, comm);
+        break;
+    case GATHER:
+        if(hand)
+            tree_gatherv(b->send, b->block_displs, b->recv, b->scratch, comm);
+        else
+            MPI_Gather(b->send, length, MPI_BYTE, b->recv, length, MPI_BYTE,
+                       0, comm);
+        break;
+    case ALLREDUCE:
+        if(hand)
+            tree_allreduce((unsigned*) b->send, (unsigned*) b->recv,
+                           (unsigned*) b->scratch, count, comm);
+        else
+            MPI_Allreduce(b->send, b->recv, count, MPI_UNSIGNED, MPI_SUM, comm);
+        break;
+    case ALLTOALL:
+        if(hand)
+            pairwise_alltoallv(b->send, b->block_displs, b->recv,
+                               b->block_displs, comm);
+        else
+            MPI_Alltoall(b->send, length, MPI_BYTE, b->recv, length, MPI_BYTE,
+                         comm);
+        break;
+    case ALLTOALLV:
+        if(hand)
+            pairwise_alltoallv(b->send, b->a2a_displs, b->recv, b->a2a_displs,
+                               comm);
+        else
+            MPI_Alltoallv(b->send, b->a2a_counts, b->a2a_displs, MPI_BYTE,
+                          b->recv, b->a2a_counts, b->a2a_displs, MPI_BYTE,
+                          comm);
+        break;
+    }
+}
+
+
+// prepare function: fill the send buffer with a pattern depending on the
+// rank and clear the receive buffer (rank 0 broadcasts the pattern)
+void prepare(int op, size_t bytes, struct buffers* b, int rank) {
+    for(size_t i = 0; i < bytes; i++)
+        b->send[i] = (char) (rank * 7 + i);
+    if(op == BCAST && rank == 0)
+        memcpy(b->recv, b->send, bytes);
+    else
+        memset(b->recv, 0, bytes);
+}
+
+
+// measure function: validate the hand-rolled version of "op" against MPI's
+// on blocks of "length" bytes, then time both and print their CSV lines
+// (rank 0). The latency of a call is the slowest rank's, every call
+// starting after a barrier.
+void measure(int op, int length, int iterations, int warmup, MPI_Comm comm) {
+    struct buffers b;
+    int            rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // room for the largest layout, or for one unsigned (allreduce)
+    size_t bytes = 2 * (size_t) size * length + sizeof(unsigned);
+    b.send      = malloc(bytes);
+    b.recv      = malloc(bytes);
+    b.scratch   = malloc(bytes);
+    b.reference = malloc(bytes);
+    b.block_displs = malloc((size + 1) * sizeof(int));
+    b.v_counts     = malloc(size * sizeof(int));
+    b.v_displs     = malloc((size + 1) * sizeof(int));
+    b.a2a_counts   = malloc(size * sizeof(int));
+    b.a2a_displs   = malloc((size + 1) * sizeof(int));
+    double* latency = malloc(iterations * sizeof(double));
+
+    b.block_displs[0] = b.v_displs[0] = b.a2a_displs[0] = 0;
+    for(int r = 0; r < size; r++) {
+        b.v_counts[r]   = v_count(r, 0, length);
+        b.a2a_counts[r] = v_count(rank, r, length);
+        b.block_displs[r + 1] = b.block_displs[r] + length;
+        b.v_displs[r + 1]     = b.v_displs[r] + b.v_counts[r];
+        b.a2a_displs[r + 1]   = b.a2a_displs[r] + b.a2a_counts[r];
+    }
+
+    prepare(op, bytes, &b, rank);
+    collective(op, 0, length, &b, comm);
+    memcpy(b.reference, b.recv, bytes);
+    prepare(op, bytes, &b, rank);
+    collective(op, 1, length, &b, comm);
+    int valid = memcmp(b.recv, b.reference, bytes) == 0;
+    MPI_Allreduce(MPI_IN_PLACE, &valid, 1, MPI_INT, MPI_LAND, comm);
+
+    for(int hand = 0; hand < 2; hand++) {
+        for(int i = 0; i < warmup; i++)
+            collective(op, hand, length, &b, comm);
+
+        for(int i = 0; i < iterations; i++) {
+            MPI_Barrier(comm);
+            double t = MPI_Wtime();
+            collective(op, hand, length, &b, comm);
+            latency[i] = MPI_Wtime() - t;
+        }
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : latency, latency, iterations,
+                   MPI_DOUBLE, MPI_MAX, 0, comm);
+
+        if(rank == 0) {
+            const char* algorithm = !hand ? "mpi" :
+                                    (op == ALLTOALL || op == ALLTOALLV) ?
+                                    "pairwise" : "binomial";
+            double mean = 0.;
+            for(int i = 0; i < iterations; i++)
+                mean += latency[i];
+            mean /= iterations;
+            qsort(latency, iterations, sizeof(double), compare);
+            printf("%d,%s,%s,%d,%.3lf,%.3lf,%.3lf,%.3lf,%s\n", size,
+                   op_names[op], algorithm, op == BARRIER ? 0 : length,
+                   1e6 * latency[0], 1e6 * latency[iterations / 2],
+                   1e6 * latency[p99_index(iterations)], 1e6 * mean,
+                   valid ? "yes" : "no");
+            fflush(stdout);
+        }
+    }
+
+    free(b.send);
+    free(b.recv);
+    free(b.scratch);
+    free(b.reference);
+    free(b.block_displs);
+    free(b.v_counts);
+    free(b.v_displs);
+    free(b.a2a_counts);
+    free(b.a2a_displs);
+    free(latency);
+}
+
+
+int main(int argc, char** argv) {
+    int    rank, size, opt;
+    int    op = -1;                     // -1: all the operations
+    int    iterations = ITERATIONS, warmup = WARMUP;
+    int    min_length = MIN_LENGTH, max_length = MAX_LENGTH;
+    int    min_ranks = MIN_RANKS;
+    double factor = 4.;
+    int    error = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    while((opt = getopt(argc, argv, "o:n:w:s:S:f:r:")) != -1) {
+        switch(opt) {
+        case 'o':
+            for(op = 0; op < NB_OPS; op++)
+                if(strcmp(optarg, op_names[op]) == 0)
+                    break;
+            if(op == NB_OPS) {
+                op = -1;
+                if(strcmp(optarg, "all") != 0)
+                    error = 1;
+            }
+            break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 's': min_length = atoi(optarg); break;
+        case 'S': max_length = atoi(optarg); break;
+        case 'f': factor = atof(optarg); break;
+        case 'r': min_ranks = atoi(optarg); break;
+        default:
+            error = 1;
+        }
+    }
+
+    if(error || optind != argc || iterations <= 0 || warmup < 0 ||
+       min_length <= 0 || max_length < min_length || factor <= 1. ||
+       min_ranks <= 0) {
+        if(rank == 0)
+            fprintf(stderr, "Usage: %s [-o barrier|bcast|scatter|scatterv|"
+                            "gather|allreduce|alltoall|alltoallv|all]\n"
+                            "          [-n iterations] [-w warmup] "
+                            "[-s min-length] [-S max-length] [-f factor]\n"
+                            "          [-r min-ranks]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    if(rank == 0)
+        printf("ranks,operation,algorithm,message_len,lat_min_us,"
+               "lat_median_us,lat_p99_us,lat_mean_us,valid\n");
+
+    // communicators of the first min_ranks, 2 * min_ranks, ... ranks, and
+    // of all of them
+    int ranks = min(min_ranks, size);
+    while(1) {
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, rank < ranks ? 0 : MPI_UNDEFINED, rank,
+                       &comm);
+
+        if(comm != MPI_COMM_NULL) {
+            for(int o = 0; o < NB_OPS; o++) {
+                if(op >= 0 && o != op)
+                    continue;
+                // log-spaced sizes (consecutive sizes always differ), a
+                // barrier moves no data
+                double l = min_length;
+                while(l <= max_length) {
+                    int length = (int) l;
+                    measure(o, length, iterations, warmup, comm);
+                    if(o == BARRIER)
+                        break;
+                    l *= factor;
+                    if((int) l == length)
+                        l = length + 1;
+                }
+            }
+            MPI_Comm_free(&comm);
+        }
+
+        if(ranks == size)
+            break;
+        ranks = min(2 * ranks, size);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -1,32 +1,537 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <mpi.h>
+#include <omp.h>
 
+#define ITERATIONS   1000               // timed round trips per message size
+#define WARMUP       100                // untimed round trips per message size
+#define MIN_LENGTH   1                  // smallest message of a sweep (bytes)
+#define MAX_LENGTH   (4 * 1024 * 1024)  // largest message of a sweep (bytes)
+#define WINDOW       64                 // messages in flight (bandwidth)
+#define WINDOW_BYTES (64 * 1024 * 1024) // receive buffers limit (bandwidth)
+#define DELAY        1e-3               // late receive delay (protocol test)
+#define PROTOCOL_TRIALS 5               // sends per size (protocol test)
 
-int main(int argc, char** argv) {
-    int rank, size;
+// point-to-point modes
+#define SEND     0                      // MPI_Send / MPI_Recv
+#define SSEND    1                      // MPI_Ssend / MPI_Recv
+#define ISEND    2                      // MPI_Isend / MPI_Irecv (pre-posted)
+#define SENDRECV 3                      // MPI_Sendrecv exchange
 
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+// one-sided modes (operation and synchronisation)
+#define PUT_FENCE 4                     // MPI_Put, MPI_Win_fence
+#define PUT_PSCW  5                     // MPI_Put, post/start/complete/wait
+#define PUT_LOCK  6                     // MPI_Put, MPI_Win_lock/unlock
+#define GET_FENCE 7                     // MPI_Get, MPI_Win_fence
+#define GET_PSCW  8                     // MPI_Get, post/start/complete/wait
+#define GET_LOCK  9                     // MPI_Get, MPI_Win_lock/unlock
+#define STORE     10                    // memcpy in a shared window
+#define NB_MODES  11
 
-    if(argc != 3) {
-        if(rank == 0)
-            fprintf(stderr, "Usage: %s <number-of-messages> <length>!\n",
-                    argv[0]);
-        MPI_Finalize();
-        return 1;
+const char* mode_names[NB_MODES] = {"send", "ssend", "isend", "sendrecv",
+                                    "put-fence", "put-pscw", "put-lock",
+                                    "get-fence", "get-pscw", "get-lock",
+                                    "store"};
+
+// kind of RMA window, 1 for MPI_Win_allocate_shared (-W shared)
+int shared_window = 0;
+
+
+// compare function: compare two double values, in a way compatible with
+// C's library qsort function
+int compare(const void* p1, const void* p2) {
+    double v1 = *(const double*) p1;
+    double v2 = *(const double*) p2;
+
+    return (v1 > v2) - (v1 < v2);
+}
+
+
+// p99_index function: index of the 99th percentile of "n" sorted values,
+// never below the median one (n / 2), which it could be for small n
+int p99_index(int n) {
+    int index = (int) (0.99 * (n - 1));
+
+    return index < n / 2 ? n / 2 : index;
+}
+
+
+// busy-wait for "seconds" seconds
+void spin(double seconds) {
+    double t = MPI_Wtime();
+    while(MPI_Wtime() - t < seconds);
+}
+
+
+// one round trip of "length" bytes between processes 0 and 1 with the given
+// mode (for SENDRECV, one simultaneous exchange)
+void round_trip(int mode, char* message, char* reply, int length, int rank) {
+    MPI_Request requests[2];
+    int         peer = !rank;
+
+    switch(mode) {
+    case SEND:
+    case SSEND:
+        if(rank == 0) {
+            if(mode == SEND)
+                MPI_Send(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+            else
+                MPI_Ssend(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+            MPI_Recv(reply, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+        } else {
+            MPI_Recv(reply, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+            if(mode == SEND)
+                MPI_Send(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+            else
+                MPI_Ssend(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD);
+        }
+        break;
+    case ISEND:
+        // the reply is always received in a pre-posted buffer
+        MPI_Irecv(reply, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD, &requests[0]);
+        if(rank == 0) {
+            MPI_Isend(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD,
+                      &requests[1]);
+            MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+        } else {
+            MPI_Wait(&requests[0], MPI_STATUS_IGNORE);
+            MPI_Isend(message, length, MPI_CHAR, peer, 0, MPI_COMM_WORLD,
+                      &requests[1]);
+            MPI_Wait(&requests[1], MPI_STATUS_IGNORE);
+        }
+        break;
+    case SENDRECV:
+        MPI_Sendrecv(message, length, MPI_CHAR, peer, 0, reply, length,
+                     MPI_CHAR, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        break;
     }
-    int number_of_messages = atoi(argv[1]);
-    int length             = atoi(argv[2]);
+}
 
-    if(size != 2 || number_of_messages <= 0 || length <= 0) {
-        if(rank == 0)
-            fprintf(stderr, "Error: need two processes and valid parameters!\n");
-        MPI_Finalize();
-        return 1;
+
+// rma_operation function: put "length" bytes of "message" at "offset" in
+// the window of "peer", or get them from there into "buffer"
+void rma_operation(int mode, char* message, char* buffer, int length, int peer,
+                   MPI_Aint offset, MPI_Win win) {
+    if(mode == PUT_FENCE || mode == PUT_PSCW || mode == PUT_LOCK)
+        MPI_Put(message, length, MPI_CHAR, peer, offset, length, MPI_CHAR, win);
+    else
+        MPI_Get(buffer, length, MPI_CHAR, peer, offset, length, MPI_CHAR, win);
+}
+
+
+// rma_round_trip function: one round trip of "length" bytes through the
+// window: process 0 accesses process 1's window, then the reverse. With
+// passive-target synchronisation, process 1 takes no part in an access, so
+// only process 0 locks, accesses and unlocks (a one-way latency). STORE
+// copies straight into the peer's shared memory and signals it with an
+// empty message.
+void rma_round_trip(int mode, MPI_Win win, MPI_Group peer_group,
+                    char* peer_memory, char* message, char* reply, int length,
+                    int rank) {
+    int peer = !rank;
+
+    switch(mode) {
+    case PUT_FENCE:
+    case GET_FENCE:
+        for(int turn = 0; turn < 2; turn++) {
+            if(rank == turn)
+                rma_operation(mode, message, reply, length, peer, 0, win);
+            MPI_Win_fence(0, win);
+        }
+        break;
+    case PUT_PSCW:
+    case GET_PSCW:
+        for(int turn = 0; turn < 2; turn++) {
+            if(rank == turn) {
+                MPI_Win_start(peer_group, 0, win);
+                rma_operation(mode, message, reply, length, peer, 0, win);
+                MPI_Win_complete(win);
+            } else {
+                MPI_Win_post(peer_group, 0, win);
+                MPI_Win_wait(win);
+            }
+        }
+        break;
+    case PUT_LOCK:
+    case GET_LOCK:
+        if(rank == 0) {
+            MPI_Win_lock(MPI_LOCK_SHARED, peer, 0, win);
+            rma_operation(mode, message, reply, length, peer, 0, win);
+            MPI_Win_unlock(peer, win);
+        }
+        break;
+    case STORE:
+        for(int turn = 0; turn < 2; turn++) {
+            if(rank == turn) {
+                memcpy(peer_memory, message, length);
+                MPI_Win_sync(win);
+                MPI_Send(NULL, 0, MPI_BYTE, peer, 4, MPI_COMM_WORLD);
+            } else {
+                MPI_Recv(NULL, 0, MPI_BYTE, peer, 4, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+                MPI_Win_sync(win);
+            }
+        }
+        break;
+    }
+}
+
+
+// rma_bandwidth function: return the bandwidth (MiB/s) of "iterations"
+// epochs of "window" accesses of "length" bytes, either from process 0 or
+// from both processes at once. Accesses of an epoch go to consecutive
+// offsets of the target window (gets to consecutive offsets of
+// "window_buffer").
+double rma_bandwidth(int mode, MPI_Win win, MPI_Group peer_group,
+                     char* peer_memory, int length, int iterations,
+                     int bidirectional, char* message, char* window_buffer,
+                     int window, int rank) {
+    int peer   = !rank;
+    int active = bidirectional || rank == 0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    for(int i = 0; i < iterations; i++) {
+        switch(mode) {
+        case PUT_FENCE:
+        case GET_FENCE:
+            if(active)
+                for(int w = 0; w < window; w++)
+                    rma_operation(mode, message, window_buffer + (size_t) w * length,
+                                  length, peer, (MPI_Aint) w * length, win);
+            MPI_Win_fence(0, win);
+            break;
+        case PUT_PSCW:
+        case GET_PSCW:
+            if(!active || bidirectional)
+                MPI_Win_post(peer_group, 0, win);
+            if(active) {
+                MPI_Win_start(peer_group, 0, win);
+                for(int w = 0; w < window; w++)
+                    rma_operation(mode, message, window_buffer + (size_t) w * length,
+                                  length, peer, (MPI_Aint) w * length, win);
+                MPI_Win_complete(win);
+            }
+            if(!active || bidirectional)
+                MPI_Win_wait(win);
+            break;
+        case PUT_LOCK:
+        case GET_LOCK:
+            if(active) {
+                MPI_Win_lock(MPI_LOCK_SHARED, peer, 0, win);
+                for(int w = 0; w < window; w++)
+                    rma_operation(mode, message, window_buffer + (size_t) w * length,
+                                  length, peer, (MPI_Aint) w * length, win);
+                MPI_Win_unlock(peer, win);
+            }
+            break;
+        case STORE:
+            if(active) {
+                for(int w = 0; w < window; w++)
+                    memcpy(peer_memory + (size_t) w * length, message, length);
+                MPI_Win_sync(win);
+                MPI_Send(NULL, 0, MPI_BYTE, peer, 4, MPI_COMM_WORLD);
+            }
+            if(!active || bidirectional) {
+                MPI_Recv(NULL, 0, MPI_BYTE, peer, 4, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+                MPI_Win_sync(win);
+            }
+            break;
+        }
+    }
+    // the passive target of a one-way transfer has no timing of its own
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t2 = MPI_Wtime();
+
+    double bytes = (bidirectional ? 2. : 1.) * length * window * iterations;
+    return bytes / (1024. * 1024. * (t2 - t1));
+}
+
+
+// create_window function: allocate a window of "bytes" bytes on both
+// processes (shared memory with -W shared), the group of the peer for
+// PSCW synchronisation and, for a shared window, the address of the peer's
+// memory
+void create_window(size_t bytes, int rank, MPI_Win* win, MPI_Group* peer_group,
+                   char** peer_memory) {
+    MPI_Group group;
+    char*     base;
+    int       peer = !rank;
+
+    *peer_memory = NULL;
+    if(shared_window) {
+        MPI_Aint peer_size;
+        int      disp_unit;
+        MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &base,
+                                win);
+        MPI_Win_shared_query(*win, peer, &peer_size, &disp_unit, peer_memory);
+    } else
+        MPI_Win_allocate(bytes, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &base, win);
+
+    MPI_Win_get_group(*win, &group);
+    MPI_Group_incl(group, 1, &peer, peer_group);
+    MPI_Group_free(&group);
+}
+
+
+// bandwidth function: return the bandwidth (MiB/s) of "iterations" windows
+// of messages of "length" bytes, either from process 0 to process 1 (the
+// receiver acknowledges every window) or in both directions at once
+double bandwidth(int length, int iterations, int bidirectional, char* message,
+                 char* window_buffer, int window, int rank) {
+    MPI_Request requests[2 * WINDOW];
+    char        ack = 0;
+    int         peer = !rank;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    for(int i = 0; i < iterations; i++) {
+        int nb_requests = 0;
+        if(bidirectional || rank == 1)
+            for(int w = 0; w < window; w++)
+                MPI_Irecv(window_buffer + (size_t) w * length, length, MPI_CHAR,
+                          peer, 1, MPI_COMM_WORLD, &requests[nb_requests++]);
+        if(bidirectional || rank == 0)
+            for(int w = 0; w < window; w++)
+                MPI_Isend(message, length, MPI_CHAR, peer, 1, MPI_COMM_WORLD,
+                          &requests[nb_requests++]);
+        MPI_Waitall(nb_requests, requests, MPI_STATUSES_IGNORE);
+        if(!bidirectional) {
+            if(rank == 0)
+                MPI_Recv(&ack, 1, MPI_CHAR, peer, 2, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+            else
+                MPI_Send(&ack, 1, MPI_CHAR, peer, 2, MPI_COMM_WORLD);
+        }
+    }
+    double t2 = MPI_Wtime();
+
+    double bytes = (bidirectional ? 2. : 1.) * length * window * iterations;
+    return bytes / (1024. * 1024. * (t2 - t1));
+}
+
+
+// is_rendezvous function: return 1 if a standard MPI_Send of "length" bytes
+// waits for the matching receive (rendezvous protocol), 0 if it completes
+// before (eager protocol). Process 1 posts its receive DELAY seconds late
+// and process 0 checks whether MPI_Send returned before that. The fastest
+// of PROTOCOL_TRIALS sends is kept, so that noise cannot make an eager send
+// look like a rendezvous.
+int is_rendezvous(int length, char* message, char* reply, int rank) {
+    double elapsed = DELAY;
+
+    for(int trial = 0; trial < PROTOCOL_TRIALS; trial++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        if(rank == 0) {
+            double t = MPI_Wtime();
+            MPI_Send(message, length, MPI_CHAR, 1, 3, MPI_COMM_WORLD);
+            t = MPI_Wtime() - t;
+            if(t < elapsed)
+                elapsed = t;
+        } else {
+            spin(DELAY);
+            MPI_Recv(reply, length, MPI_CHAR, 0, 3, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+        }
+    }
+    MPI_Bcast(&elapsed, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return elapsed > DELAY / 2;
+}
+
+
+// measure function: run the whole measurement for one mode and one message
+// length and print its CSV line (process 0). Latency is half a round trip
+// (a whole exchange for SENDRECV, a single access for passive-target RMA).
+// The eager/rendezvous protocol is only tested for two-sided modes.
+void measure(int mode, int length, int iterations, int warmup, int rank,
+             int* protocol_switch) {
+    char*   message = malloc(length);
+    char*   reply   = malloc(length);
+    double* latency = malloc(iterations * sizeof(double));
+    int     window  = WINDOW;
+    int     rma     = mode >= PUT_FENCE;
+    double  trip    = (mode == SENDRECV || mode == PUT_LOCK ||
+                       mode == GET_LOCK) ? 1. : 2.;
+    MPI_Win   win = MPI_WIN_NULL;
+    MPI_Group peer_group = MPI_GROUP_NULL;
+    char*     peer_memory = NULL;
+
+    if((long) window * length > WINDOW_BYTES)
+        window = (WINDOW_BYTES / length > 0) ? WINDOW_BYTES / length : 1;
+    char* window_buffer = malloc((size_t) window * length);
+    memset(message, rank, length);
+
+    if(rma) {
+        create_window((size_t) window * length, rank, &win, &peer_group,
+                      &peer_memory);
+        if(mode == PUT_FENCE || mode == GET_FENCE)
+            MPI_Win_fence(0, win);
+        if(mode == STORE)
+            MPI_Win_lock_all(0, win);
+    }
+
+    for(int i = 0; i < warmup; i++)
+        if(rma)
+            rma_round_trip(mode, win, peer_group, peer_memory, message, reply,
+                           length, rank);
+        else
+            round_trip(mode, message, reply, length, rank);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    for(int i = 0; i < iterations; i++) {
+        double t = MPI_Wtime();
+        if(rma)
+            rma_round_trip(mode, win, peer_group, peer_memory, message, reply,
+                           length, rank);
+        else
+            round_trip(mode, message, reply, length, rank);
+        latency[i] = (MPI_Wtime() - t) / trip;
+    }
+    double t2 = MPI_Wtime();
+
+    int bw_iterations = iterations / 10 > 0 ? iterations / 10 : 1;
+    double bw_uni, bw_bi;
+    int    rendezvous = 0;
+    if(rma) {
+        bw_uni = rma_bandwidth(mode, win, peer_group, peer_memory, length,
+                               bw_iterations, 0, message, window_buffer,
+                               window, rank);
+        bw_bi  = rma_bandwidth(mode, win, peer_group, peer_memory, length,
+                               bw_iterations, 1, message, window_buffer,
+                               window, rank);
+        if(mode == STORE)
+            MPI_Win_unlock_all(win);
+        MPI_Group_free(&peer_group);
+        MPI_Win_free(&win);
+    } else {
+        bw_uni = bandwidth(length, bw_iterations, 0, message, window_buffer,
+                           window, rank);
+        bw_bi  = bandwidth(length, bw_iterations, 1, message, window_buffer,
+                           window, rank);
+        rendezvous = is_rendezvous(length, message, reply, rank);
+        if(*protocol_switch == -2)
+            *protocol_switch = -1;
+        if(rendezvous && *protocol_switch < 0)
+            *protocol_switch = length;
     }
 
+    if(rank == 0) {
+        double total_time = t2 - t1;
+        double throughput = (mode == PUT_LOCK || mode == GET_LOCK ? 1. : 2.) *
+                            length * iterations / (1024. * 1024. * total_time);
+        qsort(latency, iterations, sizeof(double), compare);
+        printf("%d,%lf,%lf,%s,%.3lf,%.3lf,%.3lf,%lf,%lf,%s\n", length,
+               total_time, throughput, mode_names[mode], 1e6 * latency[0],
+               1e6 * latency[iterations / 2],
+               1e6 * latency[p99_index(iterations)], bw_uni, bw_bi,
+               rma ? (shared_window ? "shared" : "allocate") :
+               (rendezvous ? "rendezvous" : "eager"));
+        fflush(stdout);
+    }
+
+    free(message);
+    free(reply);
+    free(latency);
+    free(window_buffer);
+}
+
+
+// message_rate function: return the aggregate rate (messages/s) of
+// "iterations" windows of messages of "length" bytes sent by every pair of
+// processes (rank r < size / 2 sends to rank r + size / 2, so that pairs
+// span nodes with a block mapping) and by every one of their "threads"
+// OpenMP threads, each on its own communicator. The receivers acknowledge
+// every window. The slowest process gives the time.
+double message_rate(int length, int iterations, int threads, char* buffers,
+                    int window, MPI_Comm* comms, int rank, int size) {
+    int half   = size / 2;
+    int sender = rank < half;
+    int peer   = sender ? rank + half : rank - half;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    #pragma omp parallel num_threads(threads)
+    {
+        MPI_Request requests[WINDOW];
+        char        ack = 0;
+        int         thread = omp_get_thread_num();
+        char*       buffer = buffers + (size_t) thread * window * length;
+
+        for(int i = 0; i < iterations; i++) {
+            for(int w = 0; w < window; w++)
+                if(sender)
+                    MPI_Isend(buffer, length, MPI_CHAR, peer, 5, comms[thread],
+                              &requests[w]);
+                else
+                    MPI_Irecv(buffer + (size_t) w * length, length, MPI_CHAR,
+                              peer, 5, comms[thread], &requests[w]);
+            MPI_Waitall(window, requests, MPI_STATUSES_IGNORE);
+            if(sender)
+                MPI_Recv(&ack, 1, MPI_CHAR, peer, 6, comms[thread],
+                         MPI_STATUS_IGNORE);
+            else
+                MPI_Send(&ack, 1, MPI_CHAR, peer, 6, comms[thread]);
+        }
+    }
+    double elapsed = MPI_Wtime() - t1;
+    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    return (double) half * threads * iterations * window / elapsed;
+}
+
+
+// rate_sweep function: print the aggregate message rate and bandwidth of
+// all the pairs for every message length of the sweep (process 0)
+void rate_sweep(int threads, int iterations, int warmup, int min_length,
+                int max_length, double factor, int rank, int size) {
+    MPI_Comm* comms = malloc(threads * sizeof(MPI_Comm));
+
+    for(int t = 0; t < threads; t++)
+        MPI_Comm_dup(MPI_COMM_WORLD, &comms[t]);
+
+    if(rank == 0)
+        printf("pairs,threads,message_len,msg_rate,bandwidth\n");
+
+    double l = min_length;
+    while(l <= max_length) {
+        int length = (int) l;
+        int window = WINDOW;
+        if((long) window * length > WINDOW_BYTES)
+            window = (WINDOW_BYTES / length > 0) ? WINDOW_BYTES / length : 1;
+        char* buffers = calloc((size_t) threads * window, length);
+
+        if(warmup > 0)
+            message_rate(length, warmup, threads, buffers, window, comms, rank,
+                         size);
+        double rate = message_rate(length, iterations, threads, buffers,
+                                   window, comms, rank, size);
+        if(rank == 0) {
+            printf("%d,%d,%d,%lf,%lf\n", size / 2 * threads, threads, length,
+                   rate, rate * length / (1024. * 1024.));
+            fflush(stdout);
+        }
+        free(buffers);
+
+        l *= factor;
+        if((int) l == length)
+            l = length + 1;
+    }
+
+    for(int t = 0; t < threads; t++)
+        MPI_Comm_free(&comms[t]);
+    free(comms);
+}
+
+
+// legacy function: the original measurement (<number-of-messages> round
+// trips of <length> bytes with MPI_Ssend), printed as one CSV line
+void legacy(int number_of_messages, int length, int rank) {
     char*  message = malloc(length);
     double t1      = MPI_Wtime();
 
@@ -42,17 +547,181 @@ int main(int argc, char** argv) {
     double t2 = MPI_Wtime();
 
     if(rank == 0) {
-        // printf("Total time: %lg s\n", t2 - t1);
-        // printf("Throughput: %lg MiB/s\n",
-        //         (2. * length * number_of_messages + 1) / (1024. * 1024. * (t2 - t1)));
-        
+        // 2 * number_of_messages - 1 messages of length bytes were exchanged
         double total_time = t2 - t1;
-        double throughput = (2. * length * number_of_messages + 1) / (1024. * 1024. * (t2 - t1));
+        double throughput = (2. * number_of_messages - 1.) * length /
+                            (1024. * 1024. * total_time);
         printf("%d,%lf,%lf\n", length, total_time, throughput);
     }
 
     free(message);
-    MPI_Finalize();
+}
+
+
+int main(int argc, char** argv) {
+    int    rank, size, opt;
+    int    mode = -1;                   // -1: all the modes
+    int    iterations = ITERATIONS, warmup = WARMUP;
+    int    min_length = MIN_LENGTH, max_length = MAX_LENGTH;
+    double factor = 2.;
+    int    sweep = 0;
+    int    rate = 0, threads = 1;
 
+    // options are read first, as the thread level depends on them
+    while((opt = getopt(argc, argv, "m:n:w:s:S:f:W:rt:")) != -1) {
+        if(sweep == 0)                  // (keep an earlier usage error)
+            sweep = 1;
+        switch(opt) {
+        case 'm':
+            for(mode = 0; mode < NB_MODES; mode++)
+                if(strcmp(optarg, mode_names[mode]) == 0)
+                    break;
+            if(mode == NB_MODES) {
+                mode = -1;
+                if(strcmp(optarg, "all") != 0)
+                    sweep = -1;
+            }
+            break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 's': min_length = atoi(optarg); break;
+        case 'S': max_length = atoi(optarg); break;
+        case 'f': factor = atof(optarg); break;
+        case 'W':
+            if(strcmp(optarg, "shared") == 0)
+                shared_window = 1;
+            else if(strcmp(optarg, "allocate") != 0)
+                sweep = -1;
+            break;
+        case 'r': rate = 1; break;
+        case 't': rate = 1; threads = atoi(optarg); break;
+        default:
+            sweep = -1;
+        }
+    }
+
+    // every OpenMP thread of the rate mode makes its own MPI calls
+    int provided;
+    int required = (rate && threads > 1) ? MPI_THREAD_MULTIPLE
+                                         : MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, required, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // usage error, or the original mode without its two arguments
+    if(sweep < 0 || (sweep == 0 && argc - optind != 2)) {
+        if(rank == 0)
+            fprintf(stderr, "Usage: %s <number-of-messages> <length>!\n"
+                            "       %s [-m send|ssend|isend|sendrecv|put-fence|"
+                            "put-pscw|put-lock|\n"
+                            "              get-fence|get-pscw|get-lock|store|"
+                            "all] [-W allocate|shared]\n"
+                            "          [-n iterations] [-w warmup] "
+                            "[-s min-length] [-S max-length] "
+                            "[-f factor]\n"
+                            "       %s -r [-t threads] [-n iterations] "
+                            "[-w warmup] [-s min-length]\n"
+                            "          [-S max-length] [-f factor]\n",
+                    argv[0], argv[0], argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    if(!sweep) {
+        int number_of_messages = atoi(argv[optind]);
+        int length             = atoi(argv[optind + 1]);
+
+        if(size != 2 || number_of_messages <= 0 || length <= 0) {
+            if(rank == 0)
+                fprintf(stderr, "Error: need two processes and valid parameters!\n");
+            MPI_Finalize();
+            return 1;
+        }
+        legacy(number_of_messages, length, rank);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if(rate) {
+        if(size % 2 != 0 || threads <= 0 || iterations <= 0 || warmup < 0 ||
+           min_length <= 0 || max_length < min_length || factor <= 1.) {
+            if(rank == 0)
+                fprintf(stderr, "Error: need an even number of processes and "
+                                "valid parameters!\n");
+            MPI_Finalize();
+            return 1;
+        }
+        if(provided < required) {
+            if(rank == 0)
+                fprintf(stderr, "Error: MPI_THREAD_MULTIPLE is not "
+                                "supported!\n");
+            MPI_Finalize();
+            return 1;
+        }
+        rate_sweep(threads, iterations, warmup, min_length, max_length, factor,
+                   rank, size);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if(size != 2 || iterations <= 0 || warmup < 0 || min_length <= 0 ||
+       max_length < min_length || factor <= 1. ||
+       (mode == STORE && !shared_window)) {
+        if(rank == 0)
+            fprintf(stderr, "Error: need two processes and valid parameters!\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    // a shared window needs both processes on the same node
+    if(shared_window) {
+        MPI_Comm node;
+        int      node_size;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                            MPI_INFO_NULL, &node);
+        MPI_Comm_size(node, &node_size);
+        MPI_Comm_free(&node);
+        if(node_size != 2) {
+            if(rank == 0)
+                fprintf(stderr, "Error: -W shared needs both processes on "
+                                "the same node!\n");
+            MPI_Finalize();
+            return 1;
+        }
+    }
+
+    // same first columns as local.csv and remote.csv: the output of a
+    // single-mode run (-m) can be plotted by plot.py, which draws one series
+    // per file; with all the modes, rows are told apart by the mode column
+    // (the protocol of RMA modes is their kind of window)
+    if(rank == 0)
+        printf("message_len,total_time,throughput,mode,lat_min_us,"
+               "lat_median_us,lat_p99_us,bw_uni,bw_bi,protocol\n");
+
+    int protocol_switch = -2;           // -2: untested, -1: eager only
+    for(int m = 0; m < NB_MODES; m++) {
+        if((mode >= 0 && m != mode) || (m == STORE && !shared_window))
+            continue;
+        // log-spaced sizes (consecutive sizes always differ)
+        double l = min_length;
+        while(l <= max_length) {
+            int length = (int) l;
+            measure(m, length, iterations, warmup, rank, &protocol_switch);
+            l *= factor;
+            if((int) l == length)
+                l = length + 1;
+        }
+    }
+
+    if(rank == 0 && protocol_switch > -2) {
+        if(protocol_switch > 0)
+            fprintf(stderr, "eager/rendezvous crossover: MPI_Send waits for "
+                            "the receiver from %d bytes\n", protocol_switch);
+        else
+            fprintf(stderr, "eager/rendezvous crossover: not reached (eager "
+                            "up to %d bytes)\n", max_length);
+    }
+
+    MPI_Finalize();
     return 0;
 }
@@ -0,0 +1,384 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include "merge_kernels.h"
+
+#define MEMORY     (256L * 1024 * 1024) // default memory budget (bytes)
+#define READ_AHEAD (4L * 1024 * 1024)   // bytes prefetched ahead in each run
+#define OUT_BUFFER (1L << 20)           // elements written at once
+
+
+// a sorted run stored in a (deleted) temporary file, mapped in memory only
+// while it is merged
+struct run {
+    int*   data;        // first element, in the mapping of the run
+    void*  map;         // mapping (from the page holding the first element)
+    size_t map_bytes;
+    size_t offset;      // first element in the run file
+    size_t length;      // number of elements
+    size_t pos;         // next element to merge
+    size_t prefetched;  // elements up to which read-ahead was requested
+    size_t released;    // elements before which pages were released
+};
+
+
+// print an error message with the reason and stop the program
+void die(const char* message){
+    perror(message);
+    exit(1);
+}
+
+
+// read exactly "bytes" bytes at "offset" of "fd" (less at end of file),
+// return the number of bytes read
+size_t read_all(int fd, void* buffer, size_t bytes, off_t offset){
+    size_t done = 0;
+    while(done < bytes){
+        ssize_t r = pread(fd, (char*) buffer + done, bytes - done, offset + done);
+        if(r < 0) die("pread");
+        if(r == 0) break;
+        done += r;
+    }
+    return done;
+}
+
+
+// write exactly "bytes" bytes to "fd"
+void write_all(int fd, const void* buffer, size_t bytes){
+    size_t done = 0;
+    while(done < bytes){
+        ssize_t w = write(fd, (const char*) buffer + done, bytes - done);
+        if(w < 0) die("write");
+        done += w;
+    }
+}
+
+
+// write exactly "bytes" bytes at "offset" of "fd"
+void pwrite_all(int fd, const void* buffer, size_t bytes, off_t offset){
+    size_t done = 0;
+    while(done < bytes){
+        ssize_t w = pwrite(fd, (const char*) buffer + done, bytes - done,
+                           offset + done);
+        if(w < 0) die("pwrite");
+        done += w;
+    }
+}
+
+
+// create a temporary file in "tmp_dir" and return its descriptor. The file
+// is deleted right away, it lives as long as it is open and disappears even
+// if the program is interrupted
+int temp_file(const char* tmp_dir){
+    char path[4096];
+    int  fd;
+
+    snprintf(path, sizeof path, "%s/external_sort_XXXXXX", tmp_dir);
+    fd = mkstemp(path);
+    if(fd < 0) die("mkstemp");
+    unlink(path);
+    return fd;
+}
+
+
+// create_runs function: cut the input file (opened as "fd", "size"
+// elements) into chunks of "chunk" elements, sort them in parallel and
+// write them one after the other to a temporary file in "tmp_dir", whose
+// descriptor is stored in "*run_fd". Every thread reads, sorts and writes
+// its own chunks with its own buffers, so the memory used is 2 * chunk
+// elements per thread, and I/O of some threads overlaps with sorting in
+// others. Return the array of "*nb_runs" runs (not mapped).
+struct run* create_runs(int fd, size_t size, size_t chunk, const char* tmp_dir,
+                        int* run_fd, int* nb_runs){
+    int         nb_chunks = (size + chunk - 1) / chunk;
+    struct run* runs = calloc(nb_chunks + 1, sizeof *runs);
+
+    *run_fd = temp_file(tmp_dir);
+
+    #pragma omp parallel
+    {
+        int* buffer = malloc(chunk * sizeof(int));
+        int* temp   = malloc(chunk * sizeof(int));
+
+        #pragma omp for schedule(dynamic, 1)
+        for(int c = 0; c < nb_chunks; ++c){
+            size_t length = (c == nb_chunks - 1) ? size - (size_t) c * chunk : chunk;
+
+            read_all(fd, buffer, length * sizeof(int),
+                     (off_t) c * chunk * sizeof(int));
+            merge_sort_buffer(buffer, temp, length);
+            pwrite_all(*run_fd, buffer, length * sizeof(int),
+                       (off_t) c * chunk * sizeof(int));
+            runs[c].offset = (size_t) c * chunk;
+            runs[c].length = length;
+        }
+
+        free(buffer);
+        free(temp);
+    }
+
+    *nb_runs = nb_chunks;
+    return runs;
+}
+
+
+// map_runs function: map the "nb_runs" runs "runs" of the run file
+// "run_fd" in memory, for reading them sequentially
+void map_runs(struct run* runs, int nb_runs, int run_fd){
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    for(int r = 0; r < nb_runs; ++r){
+        size_t begin = runs[r].offset * sizeof(int);
+        size_t base  = begin / page * page;
+
+        runs[r].map_bytes = begin - base + runs[r].length * sizeof(int);
+        runs[r].map = mmap(NULL, runs[r].map_bytes, PROT_READ, MAP_PRIVATE,
+                           run_fd, base);
+        if(runs[r].map == MAP_FAILED) die("mmap");
+        madvise(runs[r].map, runs[r].map_bytes, MADV_SEQUENTIAL);
+        runs[r].data = (int*) ((char*) runs[r].map + (begin - base));
+        runs[r].pos = runs[r].prefetched = runs[r].released = 0;
+    }
+}
+
+
+// unmap_runs function: release the mappings of the "nb_runs" runs "runs"
+void unmap_runs(struct run* runs, int nb_runs){
+    for(int r = 0; r < nb_runs; ++r)
+        munmap(runs[r].map, runs[r].map_bytes);
+}
+
+
+// page_start function: return the start of the page holding "address"
+static inline char* page_start(const void* address){
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (char*) ((uintptr_t) address / page * page);
+}
+
+
+// advance function: move run "r" to its next element, asking the kernel to
+// read the next READ_AHEAD bytes of the run ahead of time and releasing
+// the pages which were already merged, so that the resident memory stays
+// bounded by a few windows per run
+void advance(struct run* r){
+    const size_t window = READ_AHEAD / sizeof(int);
+
+    r->pos++;
+    if(r->pos + window / 2 >= r->prefetched && r->prefetched < r->length){
+        size_t end = (r->prefetched + window < r->length) ? r->prefetched + window
+                                                          : r->length;
+        char*  begin = page_start(r->data + r->prefetched);
+        madvise(begin, (char*) (r->data + end) - begin, MADV_WILLNEED);
+        r->prefetched = end;
+    }
+    if(r->pos >= r->released + window){
+        char* begin = page_start(r->data + r->released);
+        char* end   = page_start(r->data + r->pos);
+        if(end > begin)
+            madvise(begin, end - begin, MADV_DONTNEED);
+        r->released = r->pos;
+    }
+}
+
+
+// merge_runs function: k-way merge of the "nb_runs" sorted runs into the
+// output file "out_fd" with the tournament (loser) tree of merge_kernels.h,
+// so that each output element costs one branch-free comparison per tree
+// level, and large sequential writes
+void merge_runs(struct run* runs, int nb_runs, int out_fd){
+    struct loser_tree lt;
+    int*   output = malloc(OUT_BUFFER * sizeof *output);
+    size_t total = 0;
+    long   nb_out = 0;
+
+    loser_tree_init(&lt, nb_runs);
+    for(int r = 0; r < nb_runs; ++r){
+        if(runs[r].length > 0)
+            lt.key[r] = loser_tree_key(runs[r].data[0], r);
+        total += runs[r].length;
+    }
+    loser_tree_build(&lt);
+
+    int w = lt.tree[0];
+    for(size_t i = 0; i < total; ++i){
+        struct run* r = &runs[w];
+
+        output[nb_out++] = r->data[r->pos];
+        advance(r);
+        w = loser_tree_replay(&lt, w, (r->pos < r->length) ?
+                              loser_tree_key(r->data[r->pos], w) : LOSER_TREE_DONE);
+
+        if(nb_out == OUT_BUFFER){
+            write_all(out_fd, output, nb_out * sizeof(int));
+            nb_out = 0;
+        }
+    }
+    write_all(out_fd, output, nb_out * sizeof(int));
+
+    loser_tree_free(&lt);
+    free(output);
+}
+
+
+// merge_passes function: merge the "nb_runs" runs "runs" of the run file
+// "run_fd" into the output file "out_fd", at most "fan_in" runs at a time:
+// while there are more runs, every group of "fan_in" consecutive runs is
+// merged into one run of a new run file (at the same offset, so the groups
+// are written one after the other), only the runs of the group being
+// merged are mapped. Resident memory is thus bounded by the read-ahead
+// windows of "fan_in" runs, whatever the number of runs. Return the number
+// of passes.
+int merge_passes(struct run* runs, int nb_runs, int run_fd, int fan_in,
+                 const char* tmp_dir, int out_fd){
+    int passes = 1;
+
+    while(nb_runs > fan_in){
+        int next_fd   = temp_file(tmp_dir);
+        int nb_groups = (nb_runs + fan_in - 1) / fan_in;
+
+        for(int g = 0; g < nb_groups; ++g){
+            int    first  = g * fan_in;
+            int    count  = (nb_runs - first < fan_in) ? nb_runs - first : fan_in;
+            size_t length = 0;
+
+            map_runs(runs + first, count, run_fd);
+            merge_runs(runs + first, count, next_fd);
+            unmap_runs(runs + first, count);
+
+            for(int r = first; r < first + count; ++r)
+                length += runs[r].length;
+            runs[g].offset = runs[first].offset;
+            runs[g].length = length;
+        }
+
+        close(run_fd);
+        run_fd  = next_fd;
+        nb_runs = nb_groups;
+        passes++;
+    }
+
+    map_runs(runs, nb_runs, run_fd);
+    merge_runs(runs, nb_runs, out_fd);
+    unmap_runs(runs, nb_runs);
+    close(run_fd);
+    return passes;
+}
+
+
+// return 1 if the file "fd" of "size" elements is sorted, 0 otherwise
+int is_sorted_file(int fd, size_t size){
+    int*   buffer = malloc(OUT_BUFFER * sizeof *buffer);
+    int    last = 0, sorted = 1;
+    size_t done = 0;
+
+    while(done < size && sorted){
+        size_t length = (size - done < OUT_BUFFER) ? size - done : OUT_BUFFER;
+        read_all(fd, buffer, length * sizeof(int), (off_t) done * sizeof(int));
+        for(size_t i = 0; i < length; ++i){
+            if((done > 0 || i > 0) && buffer[i] < last)
+                sorted = 0;
+            last = buffer[i];
+        }
+        done += length;
+    }
+
+    free(buffer);
+    return sorted;
+}
+
+
+// write "size" random integers to the file "path"
+void generate(const char* path, size_t size){
+    int  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int* buffer = malloc(OUT_BUFFER * sizeof *buffer);
+
+    if(fd < 0) die(path);
+    for(size_t done = 0; done < size; done += OUT_BUFFER){
+        size_t length = (size - done < OUT_BUFFER) ? size - done : OUT_BUFFER;
+        for(size_t i = 0; i < length; ++i)
+            buffer[i] = rand() - RAND_MAX / 2;
+        write_all(fd, buffer, length * sizeof(int));
+    }
+
+    free(buffer);
+    close(fd);
+}
+
+
+int main(int argc, char *argv[]){
+    long        memory = MEMORY;
+    const char* tmp_dir = "/tmp";
+    long        generate_size = -1;
+    int         opt;
+
+    while((opt = getopt(argc, argv, "m:d:g:")) != -1){
+        switch(opt){
+        case 'm': memory = atol(optarg) * 1024 * 1024; break;
+        case 'd': tmp_dir = optarg; break;
+        case 'g': generate_size = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-m memory-MiB] [-d tmp-dir] input output\n"
+                            "       %s -g size file\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    // test input generation: binary file of random ints
+    if(generate_size >= 0){
+        if(optind >= argc){
+            fprintf(stderr, "[!] error: missing file name\n");
+            return 1;
+        }
+        generate(argv[optind], generate_size);
+        return 0;
+    }
+
+    if(argc - optind != 2){
+        fprintf(stderr, "usage: %s [-m memory-MiB] [-d tmp-dir] input output\n",
+                argv[0]);
+        return 1;
+    }
+
+    int in_fd  = open(argv[optind], O_RDONLY);
+    int out_fd = open(argv[optind + 1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    struct stat st;
+    if(in_fd < 0) die(argv[optind]);
+    if(out_fd < 0) die(argv[optind + 1]);
+    if(fstat(in_fd, &st) < 0) die("fstat");
+
+    // every thread holds a chunk and its scratch buffer; the merge keeps
+    // about two read-ahead windows resident per merged run
+    size_t size   = st.st_size / sizeof(int);
+    size_t chunk  = memory / (2 * sizeof(int) * omp_get_max_threads());
+    int    fan_in = memory / (2 * READ_AHEAD);
+    if(chunk < SMALL_RUN) chunk = SMALL_RUN;
+    if(fan_in < 2) fan_in = 2;
+
+    double t1 = omp_get_wtime();
+    int    nb_runs, run_fd, passes;
+    struct run* runs = create_runs(in_fd, size, chunk, tmp_dir, &run_fd,
+                                   &nb_runs);
+    double t2 = omp_get_wtime();
+    passes = merge_passes(runs, nb_runs, run_fd, fan_in, tmp_dir, out_fd);
+    double t3 = omp_get_wtime();
+
+    printf("elements       : %zu (%d runs of up to %zu)\n", size, nb_runs, chunk);
+    printf("merge passes   : %d (at most %d runs at a time)\n", passes, fan_in);
+    printf("run formation  : %lf s\n", t2 - t1);
+    printf("merge          : %lf s\n", t3 - t2);
+    printf("processing time: %lf s\n", t3 - t1);
+
+    if(!is_sorted_file(out_fd, size))
+        printf("[!] error: the output file is not sorted\n");
+
+    free(runs);
+    close(in_fd);
+    close(out_fd);
+    return 0;
+}
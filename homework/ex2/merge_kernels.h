@@ -0,0 +1,150 @@
+// Sequential merge kernels shared by merge_sort.c and external_sort.c: the
+// two-way merge, the bottom-up merge sort of a buffer and the tournament
+// (loser) tree of the k-way merges.
+#ifndef MERGE_KERNELS_H
+#define MERGE_KERNELS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMALL_RUN 32              // runs sorted by insertion in merge sort
+
+
+// merge_sequential function: merge two sorted arrays (array1 of size1 and
+// array2 of size2) into the sorted array "merged" of size1 + size2
+static void merge_sequential(int* merged, int* array1, size_t size1,
+                             int* array2, size_t size2){
+    size_t i1 = 0, i2 = 0, ir = 0;
+
+    while(i1 < size1 && i2 < size2) {
+        if(array2[i2] < array1[i1])
+            merged[ir++] = array2[i2++];
+        else
+            merged[ir++] = array1[i1++];
+    }
+
+    while(i1 < size1) merged[ir++] = array1[i1++];
+
+    while(i2 < size2) merged[ir++] = array2[i2++];
+}
+
+
+// insertion_sort function: sort the small array "arr" of "size" elements
+static void insertion_sort(int* arr, size_t size){
+    for(size_t i = 1; i < size; ++i){
+        int    value = arr[i];
+        size_t j = i;
+        while(j > 0 && arr[j - 1] > value){
+            arr[j] = arr[j - 1];
+            j--;
+        }
+        arr[j] = value;
+    }
+}
+
+
+// merge_sort_buffer function: sort "arr" of "size" elements with a
+// bottom-up merge sort, using "temp" (same size) as the ping-pong buffer.
+// Runs of SMALL_RUN elements are first sorted by insertion, then runs of
+// doubling width are merged alternately from arr to temp and back, so the
+// function does not allocate anything.
+static void merge_sort_buffer(int* arr, int* temp, size_t size){
+    int* src = arr;
+    int* dst = temp;
+
+    for(size_t l = 0; l < size; l += SMALL_RUN)
+        insertion_sort(arr + l, (size - l < SMALL_RUN) ? size - l : SMALL_RUN);
+
+    for(size_t width = SMALL_RUN; width < size; width *= 2){
+        for(size_t l = 0; l < size; l += 2 * width){
+            size_t m = (l + width < size) ? l + width : size;
+            size_t r = (l + 2 * width < size) ? l + 2 * width : size;
+            merge_sequential(dst + l, src + l, m - l, src + m, r - m);
+        }
+        int* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if(src != arr)
+        memcpy(arr, src, size * sizeof(int));
+}
+
+
+// Tournament (loser) tree of a k-way merge. Every internal node keeps the
+// loser of the match played there and the overall winner is in tree[0],
+// so after each output only the path from the winner's leaf to the root
+// is replayed, with one comparison per level and conditional moves
+// instead of branches.
+struct loser_tree {
+    int       leaves;             // k rounded up to a power of two
+    uint64_t* key;                // current key of each run
+    int*      tree;               // losers, winner in tree[0]
+    int*      win;                // winners, to build the tree
+};
+
+
+// loser_tree_key function: key of the current element "value" of run "r"
+// in the loser tree. The run index in the low bits breaks ties in favour of
+// the first run (the merge is stable) and makes all keys distinct, and
+// exhausted runs get the largest key (LOSER_TREE_DONE), so a single
+// unsigned comparison is enough to play a match.
+#define LOSER_TREE_DONE UINT64_MAX
+
+static inline uint64_t loser_tree_key(int value, int r){
+    return ((uint64_t) ((uint32_t) value ^ 0x80000000u) << 32) | (uint32_t) r;
+}
+
+
+// loser_tree_init function: prepare "lt" for "k" runs, all exhausted: the
+// caller then sets key[r] of the runs r < k and calls loser_tree_build
+static void loser_tree_init(struct loser_tree* lt, int k){
+    lt->leaves = 1;
+    while(lt->leaves < k) lt->leaves *= 2;
+
+    lt->key  = malloc(lt->leaves * sizeof *lt->key);
+    lt->tree = malloc(2 * lt->leaves * sizeof *lt->tree);
+    lt->win  = malloc(2 * lt->leaves * sizeof *lt->win);
+    for(int r = 0; r < lt->leaves; ++r){
+        lt->key[r] = LOSER_TREE_DONE;
+        lt->win[lt->leaves + r] = r;
+    }
+}
+
+
+// loser_tree_build function: play all the matches from the current keys
+static void loser_tree_build(struct loser_tree* lt){
+    for(int node = lt->leaves - 1; node >= 1; --node){
+        int left = lt->win[2 * node], right = lt->win[2 * node + 1];
+        int left_wins = lt->key[left] <= lt->key[right];
+        lt->win[node]  = left_wins ? left : right;
+        lt->tree[node] = left_wins ? right : left;
+    }
+    lt->tree[0] = lt->win[1];
+}
+
+
+// loser_tree_replay function: give the winner "w" (tree[0]) its next key
+// "key" and replay its path to the root; return the new winner
+static inline int loser_tree_replay(struct loser_tree* lt, int w, uint64_t key){
+    lt->key[w] = key;
+    for(int node = (w + lt->leaves) / 2; node >= 1; node /= 2){
+        int other = lt->tree[node];
+        int swap  = lt->key[other] < lt->key[w];
+        lt->tree[node] = swap ? w : other;
+        w              = swap ? other : w;
+    }
+    lt->tree[0] = w;
+    return w;
+}
+
+
+// loser_tree_free function: release the memory of "lt"
+static void loser_tree_free(struct loser_tree* lt){
+    free(lt->key);
+    free(lt->tree);
+    free(lt->win);
+}
+
+#endif
@@ -1,8 +1,27 @@
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <mpi.h>
+#include <omp.h>
+#include "../../openmp/dac.h"
+#include "merge_kernels.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define N 65536
+#define CHUNK 8192  // number of elements per message in the merge tree
+#define PARALLEL_MERGE_MIN 65536  // smaller merges are done by one thread
+#define SORT_TASKS_PER_THREAD 4   // local sort leaves per OpenMP thread
+#define TREE   0                  // -a tree: binary merge tree
+#define GATHER 1                  // -a gather: k-way merge on process 0
+#define SAMPLE 2                  // -a sample: distributed sample sort
+#define CODEC_BLOCK 128           // elements per bit-packed block (-z option)
+// maximum number of 32-bit words of an encoded array of n elements
+#define CODEC_MAX_WORDS(n) (2 + ((n) + CODEC_BLOCK - 1) / CODEC_BLOCK * (1 + CODEC_BLOCK))
 
 
 // compare function: compare two integer values (pointed by parameters
@@ -20,14 +39,26 @@ int compare(const void* p1, const void* p2) {
 }
 
 
-// return 1 if a number "n" is a power of two, 0 otherwise.
-int is_power_of_two(int n) {
-    if(n == 0) return 0;
-    while(n != 1) {
-        if(n % 2 != 0) return 0;
-        n = n / 2;
+// fill counts and displs with the block size and offset of each of the
+// "size" processes when "n" elements are distributed as evenly as possible
+// (the first n % size processes get one more element)
+void block_distribution(int n, int size, int* counts, int* displs) {
+    int offset = 0;
+    for(int r = 0; r < size; ++r){
+        counts[r] = n / size + (r < n % size);
+        displs[r] = offset;
+        offset += counts[r];
     }
-    return 1;
+}
+
+
+// return the total number of elements held by processes first..last-1,
+// i.e. the length of the run they hold together after merging
+int run_length(int* counts, int first, int last, int size) {
+    int length = 0;
+    for(int r = first; r < last && r < size; ++r)
+        length += counts[r];
+    return length;
 }
 
 
@@ -41,140 +72,965 @@ int is_sorted(int *arr, int size){
 }
 
 
-void _merge(int *arr, int l, int m, int r){
-    int temp_size = r - l + 1;
-    int *temp = malloc(temp_size * sizeof *temp);
-    int li = l, ri = m+1, ti = 0;
+// co_rank function: return the number of elements of array1 among the
+// first k elements of the merge of array1 (size1) and array2 (size2), ties
+// being taken from array1 first like merge_sequential does
+int co_rank(int k, int* array1, int size1, int* array2, int size2){
+    int lo = (k > size2) ? k - size2 : 0;
+    int hi = (k < size1) ? k : size1;
 
-    while(li <= m && ri <= r){
-        if(arr[li] <= arr[ri])
-            temp[ti++] = arr[li++];
+    while(lo < hi){
+        int i = lo + (hi - lo) / 2;
+        int j = k - i;
+        if(j > 0 && i < size1 && array2[j - 1] >= array1[i])
+            lo = i + 1;
         else
-            temp[ti++] = arr[ri++];
+            hi = i;
     }
+    return lo;
+}
+
 
-    while(li <= m)
-        temp[ti++] = arr[li++];
+// merge_slice function: compute slice "s" out of "nb_slices" equal slices
+// of the merge of array1 and array2 (merge path partitioning: the co-ranks
+// of both ends of the output slice give the input ranges to merge)
+void merge_slice(int* merged, int* array1, int size1, int* array2, int size2,
+                 int s, int nb_slices){
+    long total = (long) size1 + size2;
+    int  k0 = total * s / nb_slices;
+    int  k1 = total * (s + 1) / nb_slices;
+    int  i0 = co_rank(k0, array1, size1, array2, size2);
+    int  i1 = co_rank(k1, array1, size1, array2, size2);
 
-    while(ri <= r)
-        temp[ti++] = arr[ri++];
+    merge_sequential(merged + k0, array1 + i0, i1 - i0,
+                     array2 + (k0 - i0), (k1 - i1) - (k0 - i0));
+}
+
+
+// merge function: merge two sorted arrays (array1 of size1 and
+// array2 of size2) merged sorted array of size1 + size2. Large merges are
+// split into equal output slices merged by different threads, as tasks if
+// we are already inside a parallel region, or in a new parallel region.
+void merge(int* merged, int* array1, int size1, int* array2, int size2){
+    if(size1 + size2 < PARALLEL_MERGE_MIN){
+        merge_sequential(merged, array1, size1, array2, size2);
+        return;
+    }
 
-    for(int i = 0; i < temp_size; ++i)
-        arr[l+i] = temp[i];
+    if(omp_in_parallel()){
+        int nb_slices = omp_get_num_threads();
+        #pragma omp taskloop
+        for(int s = 0; s < nb_slices; ++s)
+            merge_slice(merged, array1, size1, array2, size2, s, nb_slices);
+    }
+    else{
+        #pragma omp parallel
+        merge_slice(merged, array1, size1, array2, size2,
+                    omp_get_thread_num(), omp_get_num_threads());
+    }
 }
 
 
-void _merge_sort(int *arr, int l, int r){
-    if(l >= r) return;
+// merge_sort function: sort "arr" of "size" elements, allocating the
+// scratch buffer once
+void merge_sort(int* arr, int size){
+    int* temp = malloc((size + 1) * sizeof *temp);
+    merge_sort_buffer(arr, temp, size);
+    free(temp);
+}
+
 
-    int m = l + (r-l)/2;
+// parallel merge sort on the divide-and-conquer skeleton: a block of
+// "size" elements (with its scratch space "temp") is divided into its two
+// halves, which are merged back through temp once sorted; blocks below the
+// size cutoff use the bottom-up merge sort
+struct sort_problem {
+    int* array;
+    int* temp;
+    int  size;
+};
 
-    _merge_sort(arr, l, m);
-    _merge_sort(arr, m + 1, r);
+int sort_divide(void* problem, void* children){
+    struct sort_problem* p = problem;
+    struct sort_problem* c = children;
+    int half = p->size / 2;
 
-    _merge(arr, l, m, r);
+    if(p->size <= SMALL_RUN)
+        return 0;
+    c[0].array = p->array;
+    c[0].temp  = p->temp;
+    c[0].size  = half;
+    c[1].array = p->array + half;
+    c[1].temp  = p->temp + half;
+    c[1].size  = p->size - half;
+    return 2;
 }
 
+void sort_combine(void* problem, void* children, int nb_children){
+    struct sort_problem* p = problem;
+    int half = p->size / 2;
 
-void merge_sort(int *arr, int size){
-    _merge_sort(arr, 0, size-1);
+    (void) children;
+    (void) nb_children;
+    merge(p->temp, p->array, half, p->array + half, p->size - half);
+    memcpy(p->array, p->temp, p->size * sizeof(int));
 }
 
+void sort_solve(void* problem){
+    struct sort_problem* p = problem;
 
-// merge function: merge two sorted arrays (array1 of size1 and
-// array2 of size2) merged sorted array of size1 + size2
-void merge(int* merged, int* array1, int size1, int* array2, int size2){
-    int i1 = 0, i2 = 0, ir = 0;
+    merge_sort_buffer(p->array, p->temp, p->size);
+}
+
+size_t sort_size(const void* problem){
+    return ((const struct sort_problem*) problem)->size;
+}
 
-    while(i1 < size1 && i2 < size2) {
-        if(array2[i2] < array1[i1])
-            merged[ir++] = array2[i2++];
+const struct dac_ops sort_ops = {
+    sizeof(struct sort_problem), sort_divide, sort_combine, sort_solve,
+    sort_size
+};
+
+
+// parallel_sort function: sort "array" of "size" elements with all the
+// OpenMP threads of the process, using "temp" (same size) as scratch space
+// (size cutoff: SORT_TASKS_PER_THREAD leaves per thread, of at least 1024
+// elements)
+void parallel_sort(int* array, int* temp, int size){
+    struct sort_problem problem = {array, temp, size};
+    struct dac          dac;
+    int                 leaves = omp_get_max_threads() * SORT_TASKS_PER_THREAD;
+    int                 cutoff = (size + leaves - 1) / leaves;
+
+    if(cutoff < 1024) cutoff = 1024;
+
+    dac_init(&dac, &sort_ops, DAC_CUTOFF_SIZE);
+    dac.min_size = cutoff + 1;
+    dac_run(&dac, &problem);
+}
+
+
+// return the index of the first element of arr[lo..hi-1] which is greater
+// than value (hi if there is none)
+int upper_bound(int* arr, int lo, int hi, int value){
+    while(lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        if(arr[mid] <= value)
+            lo = mid + 1;
         else
-            merged[ir++] = array1[i1++];
+            hi = mid;
+    }
+    return lo;
+}
+
+
+// codec_encode function: compress the sorted array "values" of "count"
+// elements into "out" and return the number of 32-bit words written. The
+// format is: count, first value, then for every block of CODEC_BLOCK
+// elements the bit width w of its deltas to the previous element followed
+// by the deltas bit-packed on w bits. The deltas are packed in 4 interleaved
+// lanes (delta j goes in lane j % 4) so that the decoder can unpack 4
+// consecutive deltas with the same shifts, in one SIMD register.
+int codec_encode(const int* values, int count, uint32_t* out){
+    uint32_t deltas[CODEC_BLOCK];
+    uint32_t previous = count > 0 ? (uint32_t) values[0] : 0;
+    int      nb_words = 2;
+
+    out[0] = count;
+    out[1] = previous;
+    for(int b = 0; b < count; b += CODEC_BLOCK){
+        uint32_t bits = 0;
+        for(int j = 0; j < CODEC_BLOCK; ++j){
+            uint32_t value = (b + j < count) ? (uint32_t) values[b + j] : previous;
+            deltas[j] = value - previous;
+            bits |= deltas[j];
+            previous = value;
+        }
+        int       width = bits ? 32 - __builtin_clz(bits) : 0;
+        uint32_t* block = out + nb_words + 1;
+
+        out[nb_words] = width;
+        memset(block, 0, 4 * width * sizeof(uint32_t));
+        for(int j = 0; j < CODEC_BLOCK; ++j){
+            int bit  = (j / 4) * width;
+            int word = bit / 32, offset = bit % 32, lane = j % 4;
+            block[4 * word + lane] |= deltas[j] << offset;
+            if(offset + width > 32)
+                block[4 * (word + 1) + lane] |= deltas[j] >> (32 - offset);
+        }
+        nb_words += 1 + 4 * width;
+    }
+    return nb_words;
+}
+
+
+// codec_decode function: decompress the output of codec_encode from "in"
+// into "values" (which must have room for the count rounded up to
+// CODEC_BLOCK elements) and return the number of elements
+int codec_decode(const uint32_t* in, int* values){
+    int       count = in[0];
+    uint32_t  previous = in[1];
+    const uint32_t* word_ptr = in + 2;
+
+    for(int b = 0; b < count; b += CODEC_BLOCK){
+        int width = *word_ptr;
+        const uint32_t* block = word_ptr + 1;
+        uint32_t mask = (width == 32) ? 0xffffffffu : (1u << width) - 1;
+#ifdef __SSE2__
+        // unpack 4 deltas at once, then a 4-wide prefix sum
+        __m128i vmask = _mm_set1_epi32(mask);
+        __m128i vprev = _mm_set1_epi32(previous);
+        for(int i = 0; i < CODEC_BLOCK / 4; ++i){
+            int bit = i * width, word = bit / 32, offset = bit % 32;
+            __m128i x = _mm_srl_epi32(_mm_loadu_si128((const __m128i*) (block + 4 * word)),
+                                      _mm_cvtsi32_si128(offset));
+            if(offset + width > 32)
+                x = _mm_or_si128(x, _mm_sll_epi32(
+                        _mm_loadu_si128((const __m128i*) (block + 4 * (word + 1))),
+                        _mm_cvtsi32_si128(32 - offset)));
+            x = _mm_and_si128(x, vmask);
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi32(x, vprev);
+            _mm_storeu_si128((__m128i*) (values + b + 4 * i), x);
+            vprev = _mm_shuffle_epi32(x, 0xff);
+        }
+        previous = (uint32_t) values[b + CODEC_BLOCK - 1];
+#else
+        for(int j = 0; j < CODEC_BLOCK; ++j){
+            int bit  = (j / 4) * width;
+            int word = bit / 32, offset = bit % 32, lane = j % 4;
+            uint32_t delta = block[4 * word + lane] >> offset;
+            if(offset + width > 32)
+                delta |= block[4 * (word + 1) + lane] << (32 - offset);
+            previous += delta & mask;
+            values[b + j] = (int) previous;
+        }
+#endif
+        word_ptr += 1 + 4 * width;
+    }
+    return count;
+}
+
+
+// send_run function: send the sorted run "array" of "length" elements to
+// process "dest" as a stream of CHUNK-sized messages, with at most two
+// sends in flight so that the receiver can start merging the first chunk
+// while the next one is transferred. If "compress" is set, every chunk is
+// sent encoded by codec_encode. The number of bytes actually sent is added
+// to "*wire_bytes".
+void send_run(int* array, int length, int dest, MPI_Comm comm, int compress,
+              long* wire_bytes){
+    MPI_Request requests[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    uint32_t*   encoded[2] = {NULL, NULL};
+    int nb_chunks = (length + CHUNK - 1) / CHUNK;
+
+    if(compress){
+        encoded[0] = malloc(CODEC_MAX_WORDS(CHUNK) * sizeof(uint32_t));
+        encoded[1] = malloc(CODEC_MAX_WORDS(CHUNK) * sizeof(uint32_t));
     }
 
-    while(i1 < size1) merged[ir++] = array1[i1++];
+    for(int c = 0; c < nb_chunks; ++c){
+        int chunk_length = (c == nb_chunks - 1) ? length - c * CHUNK : CHUNK;
+        MPI_Wait(&requests[c % 2], MPI_STATUS_IGNORE);
+        if(compress){
+            int nb_words = codec_encode(array + c * CHUNK, chunk_length,
+                                        encoded[c % 2]);
+            MPI_Isend(encoded[c % 2], nb_words, MPI_UINT32_T, dest, 0, comm,
+                      &requests[c % 2]);
+            *wire_bytes += nb_words * sizeof(uint32_t);
+        }
+        else{
+            MPI_Isend(array + c * CHUNK, chunk_length, MPI_INT, dest, 0, comm,
+                      &requests[c % 2]);
+            *wire_bytes += chunk_length * sizeof(int);
+        }
+    }
+    MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+
+    free(encoded[0]);
+    free(encoded[1]);
+}
+
+
+// post_chunk_receive function: start receiving chunk "c" of the run of
+// "partner_length" elements streamed by process "source" into "buffer"
+void post_chunk_receive(void* buffer, int c, int partner_length, int source,
+                        MPI_Comm comm, int compress, MPI_Request* request){
+    int nb_chunks = (partner_length + CHUNK - 1) / CHUNK;
+    int chunk_length = (c == nb_chunks - 1) ? partner_length - c * CHUNK : CHUNK;
 
-    while(i2 < size2) merged[ir++] = array2[i2++];
+    if(compress)
+        MPI_Irecv(buffer, CODEC_MAX_WORDS(CHUNK), MPI_UINT32_T, source, 0,
+                  comm, request);
+    else
+        MPI_Irecv(buffer, chunk_length, MPI_INT, source, 0, comm, request);
 }
 
 
-// reserve space for arrays
-int *array_init[N], *merged_init[N];
+// receive_merge_run function: merge the local sorted run "array" of
+// "length" elements with the run of "partner_length" elements streamed by
+// process "source" (see send_run) into "merged". Chunks are received in
+// two buffers: while one is being merged, the next one is in flight. Once
+// a chunk has arrived, all the local elements not greater than its last
+// element can be merged with it, so merging starts with the first chunk.
+// Compressed chunks are decoded first, which frees their buffer at once.
+void receive_merge_run(int* merged, int* array, int length,
+                       int partner_length, int source, MPI_Comm comm,
+                       int compress){
+    MPI_Request requests[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    void*       buffers[2];
+    int*        decoded = NULL;
+    int         nb_chunks = (partner_length + CHUNK - 1) / CHUNK;
+    int         i1 = 0, ir = 0;
+    size_t      buffer_size = compress ? CODEC_MAX_WORDS(CHUNK) * sizeof(uint32_t)
+                                       : CHUNK * sizeof(int);
+
+    buffers[0] = malloc(buffer_size);
+    buffers[1] = malloc(buffer_size);
+    if(compress)
+        decoded = malloc((CHUNK + CODEC_BLOCK) * sizeof(int));
+
+    for(int c = 0; c < 2 && c < nb_chunks; ++c)
+        post_chunk_receive(buffers[c], c, partner_length, source, comm,
+                           compress, &requests[c]);
+
+    for(int c = 0; c < nb_chunks; ++c){
+        int  chunk_length = (c == nb_chunks - 1) ? partner_length - c * CHUNK
+                                                 : CHUNK;
+        int* chunk = buffers[c % 2];
+
+        MPI_Wait(&requests[c % 2], MPI_STATUS_IGNORE);
+        if(compress){
+            codec_decode(buffers[c % 2], decoded);
+            chunk = decoded;
+            if(c + 2 < nb_chunks)
+                post_chunk_receive(buffers[c % 2], c + 2, partner_length,
+                                   source, comm, compress, &requests[c % 2]);
+        }
+
+        // local elements up to the last element of the chunk go first
+        int end = upper_bound(array, i1, length, chunk[chunk_length - 1]);
+        merge(merged + ir, array + i1, end - i1, chunk, chunk_length);
+        ir += end - i1 + chunk_length;
+        i1 = end;
+
+        // the buffer is free again: receive chunk c + 2 into it
+        if(!compress && c + 2 < nb_chunks)
+            post_chunk_receive(buffers[c % 2], c + 2, partner_length, source,
+                               comm, compress, &requests[c % 2]);
+    }
+
+    while(i1 < length) merged[ir++] = array[i1++];
+
+    free(buffers[0]);
+    free(buffers[1]);
+    free(decoded);
+}
+
+
+// node_ranks function: fill "ranks" with the rank in the node
+// communicator "node" of every one of the "size" processes of
+// MPI_COMM_WORLD (MPI_UNDEFINED for processes of other nodes)
+void node_ranks(MPI_Comm node, int size, int* ranks){
+    MPI_Group world_group, node_group;
+    int*      world_ranks = malloc(size * sizeof *world_ranks);
+
+    for(int r = 0; r < size; ++r)
+        world_ranks[r] = r;
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    MPI_Comm_group(node, &node_group);
+    MPI_Group_translate_ranks(world_group, size, world_ranks, node_group, ranks);
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&node_group);
+    free(world_ranks);
+}
+
+
+// share_run function: hand the sorted run "array", which lies in this
+// process's part "base" of the shared window, to process "dest" of the
+// same node: only its offset is sent, the run itself is read in place
+void share_run(int* array, int* base, int dest, MPI_Win window){
+    int offset = array - base;
+
+    // make the run visible before the partner is told it is ready
+    MPI_Win_sync(window);
+    MPI_Send(&offset, 1, MPI_INT, dest, 1, MPI_COMM_WORLD);
+}
+
+
+// merge_shared_run function: merge the local sorted run "array" of
+// "length" elements with the run of "partner_length" elements shared by
+// process "source" (see share_run), which is process "node_rank" of the
+// window, into "merged", reading the partner's run in place
+void merge_shared_run(int* merged, int* array, int length, int partner_length,
+                      int source, int node_rank, MPI_Win window){
+    MPI_Aint window_size;
+    int      disp_unit, offset;
+    int*     partner_base;
+
+    MPI_Recv(&offset, 1, MPI_INT, source, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Win_sync(window);
+    MPI_Win_shared_query(window, node_rank, &window_size, &disp_unit,
+                         &partner_base);
+    merge(merged, array, length, partner_base + offset, partner_length);
+}
+
+
+// merge_k function: merge the k sorted runs stored in "runs" (run r has
+// run_counts[r] elements and starts at run_displs[r]) into "merged" with the
+// tournament (loser) tree of merge_kernels.h
+void merge_k(int* merged, int* runs, int* run_counts, int* run_displs, int k){
+    struct loser_tree lt;
+    int*  pos   = malloc(k * sizeof *pos);   // next element of each run
+    int*  end   = malloc(k * sizeof *end);   // end of each run
+    long  total = 0;
+
+    loser_tree_init(&lt, k);
+    for(int r = 0; r < k; ++r){
+        pos[r] = run_displs[r];
+        end[r] = run_displs[r] + run_counts[r];
+        if(pos[r] < end[r])
+            lt.key[r] = loser_tree_key(runs[pos[r]], r);
+        total += end[r] - pos[r];
+    }
+    loser_tree_build(&lt);
+
+    int w = lt.tree[0];
+    for(long i = 0; i < total; ++i){
+        merged[i] = runs[pos[w]++];
+        w = loser_tree_replay(&lt, w, (pos[w] < end[w]) ?
+                              loser_tree_key(runs[pos[w]], w) : LOSER_TREE_DONE);
+    }
+
+    loser_tree_free(&lt);
+    free(pos);
+    free(end);
+}
+
+
+// merge_k_split function: find the split positions split[r] (in
+// run_displs[r]..run_displs[r]+run_counts[r]) of the k sorted runs such
+// that the elements before them are the "m" first elements of their stable
+// merge. The m-th value v is found by binary search on the values, then
+// runs contribute all their elements smaller than v and, in run order, as
+// many elements equal to v as needed.
+void merge_k_split(int* runs, int* run_counts, int* run_displs, int k, long m,
+                   int* split){
+    long lo = INT_MIN, hi = INT_MAX;
+
+    // smallest v such that at least m elements are <= v
+    while(lo < hi){
+        long mid = lo + (hi - lo) / 2;
+        long count = 0;
+        for(int r = 0; r < k; ++r)
+            count += upper_bound(runs, run_displs[r], run_displs[r] + run_counts[r],
+                                 (int) mid) - run_displs[r];
+        if(count >= m)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    long remaining = m;
+    for(int r = 0; r < k; ++r){
+        split[r] = (lo == INT_MIN) ? run_displs[r]
+                 : upper_bound(runs, run_displs[r], run_displs[r] + run_counts[r],
+                               (int) (lo - 1));
+        remaining -= split[r] - run_displs[r];
+    }
+    for(int r = 0; r < k && remaining > 0; ++r){
+        int equal_end = upper_bound(runs, split[r], run_displs[r] + run_counts[r],
+                                    (int) lo);
+        int take = (equal_end - split[r] < remaining) ? equal_end - split[r]
+                                                      : remaining;
+        split[r] += take;
+        remaining -= take;
+    }
+}
+
+
+// merge_k_parallel function: same as merge_k, with the output cut into one
+// equal slice per OpenMP thread. The input positions of the slice
+// boundaries are found with merge_k_split, then every thread merges its
+// part of the k runs with its own loser tree.
+void merge_k_parallel(int* merged, int* runs, int* run_counts, int* run_displs,
+                      int k){
+    long total = 0;
+    for(int r = 0; r < k; ++r)
+        total += run_counts[r];
+
+    if(total < PARALLEL_MERGE_MIN){
+        merge_k(merged, runs, run_counts, run_displs, k);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        int  t = omp_get_thread_num();
+        int  nt = omp_get_num_threads();
+        long first = total * t / nt;
+        int* begin  = malloc(k * sizeof *begin);
+        int* end    = malloc(k * sizeof *end);
+        int* counts = malloc(k * sizeof *counts);
+
+        merge_k_split(runs, run_counts, run_displs, k, first, begin);
+        merge_k_split(runs, run_counts, run_displs, k, total * (t + 1) / nt, end);
+        for(int r = 0; r < k; ++r)
+            counts[r] = end[r] - begin[r];
+        merge_k(merged + first, runs, counts, begin, k);
+
+        free(begin);
+        free(end);
+        free(counts);
+    }
+}
+
+
+// sample_sort function: sort the distributed array whose local part is
+// "array" of "length" elements (every process of "comm" calls it). The
+// local part is sorted, every process picks size-1 regularly spaced samples
+// and all the samples are shared with MPI_Allgather, so that every process
+// picks the same size-1 splitters. Each process then sends to process r the
+// elements between splitters r-1 and r with a single MPI_Alltoallv and
+// merges the sorted runs it received. On return, "*result" holds the local
+// part of the sorted array (process r holds elements smaller than those of
+// process r+1), and its length is returned.
+int sample_sort(int* array, int length, int** result, MPI_Comm comm){
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int* samples     = malloc(size * sizeof *samples);
+    int* all_samples = malloc(size * size * sizeof *all_samples);
+    int* splitters   = malloc(size * sizeof *splitters);
+    int* send_counts = malloc(size * sizeof *send_counts);
+    int* send_displs = malloc(size * sizeof *send_displs);
+    int* recv_counts = malloc(size * sizeof *recv_counts);
+    int* recv_displs = malloc(size * sizeof *recv_displs);
+
+    // 1. local sort
+    int* temp = malloc((length + 1) * sizeof *temp);
+    parallel_sort(array, temp, length);
+    free(temp);
+
+    // 2. regular sampling (empty parts contribute samples at the far end)
+    for(int i = 0; i < size - 1; ++i)
+        samples[i] = (length > 0) ? array[(long) (i + 1) * length / size]
+                                  : INT_MAX;
+    MPI_Allgather(samples, size - 1, MPI_INT, all_samples, size - 1, MPI_INT,
+                  comm);
+    qsort(all_samples, size * (size - 1), sizeof(int), compare);
+    for(int i = 0; i < size - 1; ++i)
+        splitters[i] = all_samples[(i + 1) * (size - 1) - (size - 1) / 2];
+
+    // 3. single all-to-all exchange: process r gets ]splitters[r-1], splitters[r]]
+    int begin = 0;
+    for(int r = 0; r < size; ++r){
+        int end = (r < size - 1) ? upper_bound(array, begin, length, splitters[r])
+                                 : length;
+        send_displs[r] = begin;
+        send_counts[r] = end - begin;
+        begin = end;
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+    int total = 0;
+    for(int r = 0; r < size; ++r){
+        recv_displs[r] = total;
+        total += recv_counts[r];
+    }
+    int* received = malloc((total + 1) * sizeof *received);
+    MPI_Alltoallv(array, send_counts, send_displs, MPI_INT,
+                  received, recv_counts, recv_displs, MPI_INT, comm);
+
+    // 4. local k-way merge of the received sorted runs
+    *result = malloc((total + 1) * sizeof **result);
+    merge_k_parallel(*result, received, recv_counts, recv_displs, size);
+
+    free(received);
+    free(samples);
+    free(all_samples);
+    free(splitters);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    return total;
+}
+
+
+// return 1 if the array distributed over the processes of "comm" (local
+// part "array" of "length" elements) is globally sorted, 0 otherwise
+int is_sorted_distributed(int* array, int length, MPI_Comm comm){
+    int rank, size, ok = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // (length, first, last) of every process
+    int  local[3] = {length, length ? array[0] : 0, length ? array[length - 1] : 0};
+    int* all = malloc(3 * size * sizeof *all);
+    MPI_Allgather(local, 3, MPI_INT, all, 3, MPI_INT, comm);
+
+    if(!is_sorted(array, length))
+        ok = 0;
+    int have_last = 0, last = 0;
+    for(int r = 0; r < size; ++r){
+        if(all[3 * r] == 0) continue;
+        if(have_last && all[3 * r + 1] < last)
+            ok = 0;
+        last = all[3 * r + 2];
+        have_last = 1;
+    }
+    free(all);
+
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+    return ok;
+}
+
+
+// read_slice function: collectively read "count" ints at element offset
+// "offset" of the binary file "path" into "array" (every process of "comm"
+// reads its own slice with MPI_File_read_at_all, so the ingest bandwidth
+// scales with the number of processes)
+void read_slice(const char* path, int* array, int count, long offset,
+                MPI_Comm comm){
+    MPI_File file;
+    if(MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file)
+       != MPI_SUCCESS){
+        fprintf(stderr, "[!] error: cannot open %s\n", path);
+        MPI_Abort(comm, 1);
+    }
+    MPI_File_read_at_all(file, (MPI_Offset) offset * sizeof(int), array, count,
+                         MPI_INT, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+}
+
+
+// write_sorted function: collectively write the sorted array, whose local
+// part is "array" of "length" elements (process r holds elements smaller
+// than those of process r+1), to the binary file "path". The offset of
+// each process is the exclusive prefix sum of the lengths.
+void write_sorted(const char* path, int* array, int length, MPI_Comm comm){
+    MPI_File file;
+    long     local_length = length, offset = 0;
+    int      rank;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan(&local_length, &offset, 1, MPI_LONG, MPI_SUM, comm);
+    if(rank == 0)
+        offset = 0;
+
+    if(MPI_File_open(comm, path, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                     MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        fprintf(stderr, "[!] error: cannot open %s\n", path);
+        MPI_Abort(comm, 1);
+    }
+    MPI_File_set_size(file, 0);
+    MPI_File_write_at_all(file, (MPI_Offset) offset * sizeof(int), array,
+                          length, MPI_INT, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+}
 
 
 int main(int argc, char *argv[]){
 
-    int*   array = array_init;    // big array
-    int*   merged = merged_init;  // array that holds the result for each process
+    int*   array;                 // big array
+    int*   merged;                // array that holds the result for each process
+    int*   counts;                // number of elements of each process
+    int*   displs;                // offset of the elements of each process
     double t1 = 0., t2 = 0.;
-    int    rank, size;
+    int    rank, size, n = N;
+    int    algorithm = TREE;      // how the sorted blocks are combined
+    int    gather = 0;            // gather the sample sort result on process 0
+    int    compress = 0;          // compress the runs sent in the merge tree
+    long   raw_bytes = 0, wire_bytes = 0;
+    char*  input = NULL;          // binary file of ints to sort (MPI-IO)
+    char*  output = NULL;         // binary file for the sorted result (MPI-IO)
+    int*   sorted;                // local part of the sorted result
+    int    sorted_length;
+    int    opt;
 
-    // initialize MPI
-    MPI_Init(&argc, &argv);
+    // initialize MPI (only the master thread makes MPI calls, outside of
+    // the OpenMP parallel regions)
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if(provided < MPI_THREAD_FUNNELED){
+        if(rank == 0)
+            fprintf(stderr, "Error: MPI_THREAD_FUNNELED is not supported!\n");
+        MPI_Finalize();
+        return 1;
+    }
 
-    // check whether size is a power of 2 which divides N
-    if(!is_power_of_two(size) || N % size != 0) {
+    // any number of processes and any array size are accepted
+    while((opt = getopt(argc, argv, "n:a:gzi:o:")) != -1){
+        switch(opt){
+        case 'n': n = atoi(optarg); break;
+        case 'a':
+            algorithm = (strcmp(optarg, "tree") == 0)   ? TREE
+                      : (strcmp(optarg, "gather") == 0) ? GATHER
+                      : (strcmp(optarg, "sample") == 0) ? SAMPLE : -1;
+            break;
+        case 'g': gather = 1; break;
+        case 'z': compress = 1; break;
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        default:  algorithm = -1; break;
+        }
+    }
+    if(algorithm == -1){
+        // unknown option or algorithm
         if(rank == 0)
-            fprintf(stderr, "[!] error: size must divide N and be a power of 2\n");
+            fprintf(stderr, "usage: %s [-n size] [-a tree|gather|sample] [-g] [-z] "
+                            "[-i input] [-o output] [size]\n", argv[0]);
         MPI_Finalize();
         return 1;
     }
+    if(optind < argc)
+        n = atoi(argv[optind]);
+    if(input != NULL){
+        // the array size is given by the input file
+        MPI_File   file;
+        MPI_Offset file_size;
+        if(MPI_File_open(MPI_COMM_WORLD, input, MPI_MODE_RDONLY, MPI_INFO_NULL,
+                         &file) != MPI_SUCCESS){
+            if(rank == 0)
+                fprintf(stderr, "[!] error: cannot open %s\n", input);
+            MPI_Finalize();
+            return 1;
+        }
+        MPI_File_get_size(file, &file_size);
+        MPI_File_close(&file);
+        n = file_size / sizeof(int);
+    }
+    if(n < 0) {
+        if(rank == 0)
+            fprintf(stderr, "[!] error: array size must be positive\n");
+        MPI_Finalize();
+        return 1;
+    }
+    if(compress && algorithm != TREE){
+        if(rank == 0)
+            fprintf(stderr, "[!] warning: -z only applies to -a tree, "
+                            "ignored\n");
+        compress = 0;
+    }
+
+    // reserve space for arrays: in the merge tree, a process never holds
+    // more than the runs of processes rank..rank+lowbit(rank)-1
+    counts = malloc(size * sizeof *counts);
+    displs = malloc(size * sizeof *displs);
+    block_distribution(n, size, counts, displs);
+    // (with an input file and a distributed result, process 0 only needs
+    // its own block)
+    int capacity;
+    if(algorithm == TREE)
+        capacity = (rank == 0) ? n
+                 : run_length(counts, rank, rank + (rank & -rank), size);
+    else if(algorithm == GATHER)
+        capacity = (rank == 0) ? n : counts[rank];
+    else
+        capacity = (rank == 0 && (input == NULL || gather)) ? n : counts[rank];
+
+    // in the merge tree, the processes of a node keep their arrays in a
+    // shared window, so that node-local merges read the partner's run in
+    // place and only the runs of other nodes go through MPI messages
+    // (unless -z asks for compressed runs: then every run is sent)
+    MPI_Comm node = MPI_COMM_NULL;
+    MPI_Win  window = MPI_WIN_NULL;
+    int*     shared_base = NULL;  // this process's part of the window
+    int*     ranks_in_node = NULL;
+    int      node_size = 1;
+    if(algorithm == TREE && !compress){
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                            MPI_INFO_NULL, &node);
+        MPI_Comm_size(node, &node_size);
+    }
+    if(node_size > 1){
+        MPI_Info info;
+        MPI_Info_create(&info);
+        // each part is allocated close to its process
+        MPI_Info_set(info, "alloc_shared_noncontig", "true");
+        MPI_Win_allocate_shared(2 * (MPI_Aint) (capacity + 1) * sizeof(int),
+                                sizeof(int), info, node, &shared_base, &window);
+        MPI_Info_free(&info);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+        array  = shared_base;
+        merged = shared_base + capacity + 1;
+        ranks_in_node = malloc(size * sizeof *ranks_in_node);
+        node_ranks(node, size, ranks_in_node);
+    }
+    else{
+        array  = malloc((capacity + 1) * sizeof *array);
+        merged = malloc((capacity + 1) * sizeof *merged);
+    }
 
-    // process 0 initializes the arrays
-    if(rank == 0){
-        // srand(time(0));
-        for(int i = 0; i < N; i++)
-            array[i] = N - i;
-            // array[i] = rand() % N;
+    if(input != NULL){
+        // every process reads its own block of the input file
+        MPI_Barrier(MPI_COMM_WORLD);
         t1 = MPI_Wtime();
+        read_slice(input, array, counts[rank], displs[rank], MPI_COMM_WORLD);
     }
+    else{
+        // process 0 initializes the arrays
+        if(rank == 0){
+            // srand(time(0));
+            for(int i = 0; i < n; i++)
+                array[i] = n - i;
+                // array[i] = rand() % n;
+            t1 = MPI_Wtime();
+        }
 
-    // distribute parts of the array to processes
-    MPI_Scatter(array, N / size, MPI_INT, array, N / size, MPI_INT, 0, MPI_COMM_WORLD);
+        // distribute parts of the array to processes (blocks may differ by one)
+        MPI_Scatterv(array, counts, displs, MPI_INT,
+                     rank == 0 ? MPI_IN_PLACE : (void*) array, counts[rank],
+                     MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
-    // each process sorts the array using quicksort
-    qsort(array, N / size, sizeof(int), compare);
+    if(algorithm == SAMPLE){
+        int* result;
+        int  length = sample_sort(array, counts[rank], &result, MPI_COMM_WORLD);
 
-    // merge
-    int step = 1;
-    while(step < size){
-        if(rank % (2 * step) == step){
-            MPI_Ssend(array, step * N / size, MPI_INT, rank - step, 0, MPI_COMM_WORLD);
+        if(gather){
+            // optional gather of the distributed result on process 0
+            MPI_Gather(&length, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            if(rank == 0){
+                displs[0] = 0;
+                for(int r = 1; r < size; ++r)
+                    displs[r] = displs[r - 1] + counts[r - 1];
+            }
+            MPI_Gatherv(result, length, MPI_INT, array, counts, displs, MPI_INT,
+                        0, MPI_COMM_WORLD);
+            free(result);
+            sorted = array;
+            sorted_length = (rank == 0) ? n : 0;
         }
-        else if(rank % (2 * step) == 0){
-            MPI_Recv(array + N / 2, step * N / size, MPI_INT, rank + step, 0,
-                     MPI_COMM_WORLD, NULL);
-            merge(merged, array, step * N / size, array + N / 2,
-                  step * N / size);
-            
-            // swap array and merged
-            int* tmp;
-            tmp    = merged;
-            merged = array;
-            array  = tmp;
+        else{
+            MPI_Barrier(MPI_COMM_WORLD);
+            t2 = MPI_Wtime();
+            int ok = is_sorted_distributed(result, length, MPI_COMM_WORLD);
+            if(rank == 0){
+                if(!ok)
+                    printf("[!] error: the output array is not sorted\n");
+                printf("processing time: %lf s\n", t2 - t1);
+            }
+            sorted = result;
+            sorted_length = length;
         }
-        step *= 2;
     }
+    else if(algorithm == GATHER){
+        // each process sorts the array using all its threads, then process
+        // 0 gathers the sorted blocks and merges them all in one pass
+        parallel_sort(array, merged, counts[rank]);
+        MPI_Gatherv(array, counts[rank], MPI_INT, merged, counts, displs,
+                    MPI_INT, 0, MPI_COMM_WORLD);
+        if(rank == 0)
+            merge_k_parallel(array, merged, counts, displs, size);
+    }
+    else{
+        // each process sorts the array using all its threads
+        parallel_sort(array, merged, counts[rank]);
+
+        // merge: at each step, a process holding the run of processes
+        // rank..rank+step-1 receives the run of processes
+        // rank+step..rank+2*step-1 (if any), runs may have different
+        // lengths. Runs are streamed in chunks and merged as they arrive,
+        // or read in place from the shared window within a node.
+        int step = 1;
+        int length = counts[rank];
+        while(step < size){
+            if(rank % (2 * step) == step){
+                if(ranks_in_node != NULL &&
+                   ranks_in_node[rank - step] != MPI_UNDEFINED)
+                    share_run(array, shared_base, rank - step, window);
+                else{
+                    send_run(array, length, rank - step, MPI_COMM_WORLD,
+                             compress, &wire_bytes);
+                    raw_bytes += length * sizeof(int);
+                }
+                break;
+            }
+            else if(rank % (2 * step) == 0 && rank + step < size){
+                int partner_length = run_length(counts, rank + step,
+                                                rank + 2 * step, size);
+                if(ranks_in_node != NULL &&
+                   ranks_in_node[rank + step] != MPI_UNDEFINED)
+                    merge_shared_run(merged, array, length, partner_length,
+                                     rank + step, ranks_in_node[rank + step],
+                                     window);
+                else
+                    receive_merge_run(merged, array, length, partner_length,
+                                      rank + step, MPI_COMM_WORLD, compress);
+                length += partner_length;
 
-    merged = array;
-    // merged is now sorted
+                // swap array and merged
+                int* tmp;
+                tmp    = merged;
+                merged = array;
+                array  = tmp;
+            }
+            step *= 2;
+        }
+    }
+
+    // array is now sorted on process 0 (unless the sample sort result was
+    // left distributed)
+    if(algorithm != SAMPLE){
+        sorted = array;
+        sorted_length = (rank == 0) ? n : 0;
+    }
 
     // check the output array
-    if(rank == 0){
+    if(rank == 0 && (algorithm != SAMPLE || gather)){
         t2 = MPI_Wtime();
-        if(!is_sorted(merged, N)){
+        if(!is_sorted(array, n)){
             printf("[!] error: the output array is not sorted\n");
         }
         printf("processing time: %lf s\n", t2 - t1);
         // printf("sorted array: ");
-        // for(int i = 0; i < N; ++i)
-            // printf("%d ", merged[i]);
+        // for(int i = 0; i < n; ++i)
+            // printf("%d ", array[i]);
         // printf("\n");
     }
 
+    // every process writes its part of the result to the output file
+    if(output != NULL){
+        double t3 = MPI_Wtime();
+        write_sorted(output, sorted, sorted_length, MPI_COMM_WORLD);
+        if(rank == 0)
+            printf("write time: %lf s\n", MPI_Wtime() - t3);
+    }
+    if(sorted != array)
+        free(sorted);
+
+    // report how many bytes the codec saved in the merge tree
+    if(compress && algorithm == TREE){
+        long local_bytes[2] = {raw_bytes, wire_bytes}, total_bytes[2];
+        MPI_Reduce(local_bytes, total_bytes, 2, MPI_LONG, MPI_SUM, 0,
+                   MPI_COMM_WORLD);
+        if(rank == 0 && total_bytes[1] > 0)
+            printf("compression ratio: %lf (%ld bytes sent instead of %ld)\n",
+                   (double) total_bytes[0] / total_bytes[1], total_bytes[1],
+                   total_bytes[0]);
+        else if(rank == 0)
+            printf("compression ratio: no run was sent (single process)\n");
+    }
+
+    // (freeing the window waits for the partners still reading our runs)
+    if(window != MPI_WIN_NULL){
+        MPI_Win_unlock_all(window);
+        MPI_Win_free(&window);
+        free(ranks_in_node);
+    }
+    else{
+        free(array);
+        free(merged);
+    }
+    if(node != MPI_COMM_NULL)
+        MPI_Comm_free(&node);
+    free(counts);
+    free(displs);
     MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
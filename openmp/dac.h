@@ -0,0 +1,142 @@
+// Generic parallel divide-and-conquer skeleton (OpenMP tasks), shared by
+// the fibonacci, quicksort and merge sort kernels.
+//
+// A problem is an opaque struct of "problem_size" bytes described by a
+// struct dac_ops: divide() splits it into at most DAC_MAX_CHILDREN
+// subproblems (returning 0 for a base case), combine() builds its result
+// from theirs once they are solved (it may be NULL) and solve() solves it
+// sequentially. A cutoff policy decides, for every problem, whether it is
+// divided into tasks or solved sequentially:
+//  - DAC_CUTOFF_DEPTH: tasks down to "max_depth" levels of recursion,
+//  - DAC_CUTOFF_SIZE:  tasks for problems of at least "min_size" (size()),
+//  - DAC_CUTOFF_LOAD:  tasks as long as fewer than "max_pending" are
+//                      pending, which adapts to unbalanced recursions.
+// The defaults give about DAC_TASKS_PER_THREAD leaves per thread. The
+// policy and its state live in a struct dac passed down the recursion (no
+// globals), so independent runs can proceed at the same time.
+#ifndef DAC_H
+#define DAC_H
+
+#include <stddef.h>
+#include <omp.h>
+
+#define DAC_MAX_CHILDREN     4  // subproblems per division
+#define DAC_TASKS_PER_THREAD 8  // leaves per thread of the default cutoffs
+
+#define DAC_CUTOFF_DEPTH 0
+#define DAC_CUTOFF_SIZE  1
+#define DAC_CUTOFF_LOAD  2
+
+struct dac_ops {
+    size_t problem_size;
+    int    (*divide)(void* problem, void* children);
+    void   (*combine)(void* problem, void* children, int nb_children);
+    void   (*solve)(void* problem);
+    size_t (*size)(const void* problem);    // (DAC_CUTOFF_SIZE only)
+};
+
+struct dac {
+    const struct dac_ops* ops;
+    int    cutoff;                          // DAC_CUTOFF_*
+    int    max_depth;
+    size_t min_size;                        // 0: derived from the root
+    int    max_pending;
+    int    pending;                         // tasks not finished yet
+};
+
+
+// dac_init function: prepare a run of "ops" with the given cutoff policy
+// and its default parameters (which may be changed before dac_run)
+static inline void dac_init(struct dac* dac, const struct dac_ops* ops,
+                            int cutoff){
+    int leaves = omp_get_max_threads() * DAC_TASKS_PER_THREAD;
+
+    dac->ops         = ops;
+    dac->cutoff      = cutoff;
+    dac->max_depth   = 0;
+    while((1 << dac->max_depth) < leaves)
+        dac->max_depth++;
+    dac->min_size    = 0;
+    dac->max_pending = leaves;
+    dac->pending     = 0;
+}
+
+
+// dac_spawn function: return 1 if "problem", at recursion depth "depth",
+// must be divided into tasks
+static inline int dac_spawn(struct dac* dac, const void* problem, int depth){
+    int pending;
+
+    switch(dac->cutoff){
+    case DAC_CUTOFF_DEPTH:
+        return depth < dac->max_depth;
+    case DAC_CUTOFF_SIZE:
+        return dac->ops->size(problem) >= dac->min_size;
+    default:
+        #pragma omp atomic read
+        pending = dac->pending;
+        return pending < dac->max_pending;
+    }
+}
+
+
+// dac_task function: solve "problem": below the cutoff sequentially,
+// otherwise by dividing it, solving all its subproblems but the last one
+// in new tasks (the last one in the current task) and combining them. The
+// subproblems live on the stack of their parent, which waits for them.
+static void dac_task(struct dac* dac, void* problem, int depth){
+    const struct dac_ops* ops = dac->ops;
+
+    if(!dac_spawn(dac, problem, depth)){
+        ops->solve(problem);
+        return;
+    }
+
+    max_align_t children[(DAC_MAX_CHILDREN * ops->problem_size +
+                          sizeof(max_align_t) - 1) / sizeof(max_align_t)];
+    int nb_children = ops->divide(problem, children);
+    if(nb_children == 0){
+        ops->solve(problem);
+        return;
+    }
+
+    for(int c = 0; c < nb_children - 1; c++){
+        void* child = (char*) children + c * ops->problem_size;
+        #pragma omp atomic update
+        dac->pending++;
+        #pragma omp task firstprivate(child)
+        {
+            dac_task(dac, child, depth + 1);
+            #pragma omp atomic update
+            dac->pending--;
+        }
+    }
+    dac_task(dac, (char*) children + (nb_children - 1) * ops->problem_size,
+             depth + 1);
+    #pragma omp taskwait
+
+    if(ops->combine != NULL)
+        ops->combine(problem, children, nb_children);
+}
+
+
+// dac_run function: solve "problem" with all the threads, in a new
+// parallel region (or, inside one, by the calling thread and tasks: the
+// caller must then be alone, e.g. in a single construct)
+static inline void dac_run(struct dac* dac, void* problem){
+    if(dac->cutoff == DAC_CUTOFF_SIZE && dac->min_size == 0)
+        dac->min_size = dac->ops->size(problem) /
+                        (omp_get_max_threads() * DAC_TASKS_PER_THREAD) + 1;
+
+    if(omp_in_parallel())
+        dac_task(dac, problem, 0);
+    else{
+        #pragma omp parallel
+        {
+            #pragma omp single
+            dac_task(dac, problem, 0);
+        }
+    }
+}
+
+#endif
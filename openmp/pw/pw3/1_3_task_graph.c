@@ -1,6 +1,8 @@
 #include <omp.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -25,42 +27,471 @@ void dag_reference(double r1, double r2, double r3, double* r) {
     *r = d6;
 }
 
-// Computation kernel (to parallelize)
-void dag_kernel(double r1, double r2, double r3, double* r) {
-    double d1, d2, d3, d4, d5, d6;
+// -------------------------------------------------------
+// DAG executor. A graph is built from a textual description with one node
+// per line: "name x y cost", the node computing f(x, y, cost) where x and
+// y are sums of '+'-separated operands, each one the name of a node or an
+// input r1, r2, ... (r<k> is the k-th input), and cost is in time units.
+// Edges follow from the operands. Nodes are prioritized by their upward
+// rank (cost of the longest path from them to an exit node, as in HEFT):
+// ready nodes wait in a max-heap on rank and every node becoming ready
+// spawns one task, which runs the ready node of highest rank. The longest
+// path is also the critical-path lower bound of the makespan.
+
+#define MAX_NAME  16      // node name length (with the '\0')
+#define MAX_TERMS 8       // operands summed in x or y
+#define MAX_LINE  512     // description line length
+#define GEN_COST  5       // generated costs are [1, GEN_COST] time units
+
+struct node {
+    char    name[MAX_NAME];
+    int     cost;
+    int     nb_terms[2];          // operands of x and y
+    int     term[2][MAX_TERMS];   // node index, or -1 - input index
+    int     nb_preds;             // distinct predecessors
+    int     nb_succs;
+    int*    succs;
+    int     pending;              // predecessors not done yet
+    double  rank;                 // upward rank, in time units
+    double  value;
+};
+
+struct dag {
+    int           nb_nodes;
+    struct node*  nodes;
+    int*          order;          // a topological order
+    const double* inputs;
+    int           nb_inputs;
+    double        time_unit;      // seconds per cost unit
+    double        total_cost;     // sum of the costs, in time units
+    double        critical_path;  // largest rank, in time units
+    int*          heap;           // ready nodes (max-heap on rank)
+    int           heap_size;
+    omp_lock_t    lock;           // protects the heap
+};
+
+// dag_error function: report a malformed description and exit
+void dag_error(const char* message, const char* line){
+    fprintf(stderr, "bad DAG description: %s: \"%s\"\n", message, line);
+    exit(1);
+}
+
+// dag_operand function: return the index of the operand "name" (a node, or
+// -1 - k for the input r<k+1>)
+int dag_operand(const struct dag* dag, int nb_names, const char* name,
+                const char* line){
+    int input, end = 0;
+
+    if(sscanf(name, "r%d%n", &input, &end) == 1 && name[end] == '\0'){
+        if(input < 1 || input > dag->nb_inputs)
+            dag_error("unknown input", line);
+        return -input;
+    }
+    for(int i = 0; i < nb_names; i++)
+        if(strcmp(dag->nodes[i].name, name) == 0)
+            return i;
+    dag_error("unknown node", line);
+    return 0;
+}
+
+// dag_add_succ function: add the edge pred -> succ, once
+void dag_add_succ(struct dag* dag, int pred, int succ){
+    struct node* node = &dag->nodes[pred];
+
+    for(int s = 0; s < node->nb_succs; s++)
+        if(node->succs[s] == succ)
+            return;
+    node->succs = realloc(node->succs, (node->nb_succs + 1) * sizeof(int));
+    node->succs[node->nb_succs++] = succ;
+    dag->nodes[succ].nb_preds++;
+}
+
+// dag_rank function: compute a topological order, the upward ranks and the
+// critical path of "dag" (exit if it has a cycle)
+void dag_rank(struct dag* dag){
+    int* in_degree = malloc(dag->nb_nodes * sizeof(int));
+    int  head = 0, tail = 0;
+
+    for(int i = 0; i < dag->nb_nodes; i++){
+        in_degree[i] = dag->nodes[i].nb_preds;
+        if(in_degree[i] == 0)
+            dag->order[tail++] = i;
+    }
+    while(head < tail){
+        struct node* node = &dag->nodes[dag->order[head++]];
+        for(int s = 0; s < node->nb_succs; s++)
+            if(--in_degree[node->succs[s]] == 0)
+                dag->order[tail++] = node->succs[s];
+    }
+    free(in_degree);
+    if(tail != dag->nb_nodes){
+        fprintf(stderr, "bad DAG description: the graph has a cycle\n");
+        exit(1);
+    }
+
+    dag->total_cost    = 0;
+    dag->critical_path = 0;
+    for(int i = dag->nb_nodes - 1; i >= 0; i--){
+        struct node* node = &dag->nodes[dag->order[i]];
+        double       longest = 0;
+        for(int s = 0; s < node->nb_succs; s++)
+            if(dag->nodes[node->succs[s]].rank > longest)
+                longest = dag->nodes[node->succs[s]].rank;
+        node->rank = node->cost + longest;
+        dag->total_cost += node->cost;
+        if(node->rank > dag->critical_path)
+            dag->critical_path = node->rank;
+    }
+}
+
+// dag_build function: build "dag" from "description" (see above), its
+// inputs being inputs[0..nb_inputs) and its time unit "time_unit" seconds
+void dag_build(struct dag* dag, const char* description,
+               const double* inputs, int nb_inputs, double time_unit){
+    char        line[MAX_LINE];
+    int         capacity = 16;
+    const char* cursor;
+
+    dag->nb_nodes  = 0;
+    dag->nodes     = malloc(capacity * sizeof(struct node));
+    dag->inputs    = inputs;
+    dag->nb_inputs = nb_inputs;
+    dag->time_unit = time_unit;
+
+    // 1. Node names and costs
+    for(cursor = description; *cursor; ){
+        size_t length = strcspn(cursor, "\n");
+        char   name[MAX_NAME];
+        int    cost;
 
-    #pragma omp parallel sections
+        if(length >= MAX_LINE)
+            dag_error("line too long", "");
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        cursor += length + (cursor[length] == '\n');
+        if(strspn(line, " \t") == length)
+            continue;
+
+        if(sscanf(line, "%15s %*s %*s %d", name, &cost) != 2 || cost < 0)
+            dag_error("expected \"name x y cost\"", line);
+        if(dag->nb_nodes == capacity){
+            capacity *= 2;
+            dag->nodes = realloc(dag->nodes, capacity * sizeof(struct node));
+        }
+        struct node* node = &dag->nodes[dag->nb_nodes++];
+        memset(node, 0, sizeof(struct node));
+        strcpy(node->name, name);
+        node->cost = cost;
+    }
+    if(dag->nb_nodes == 0)
+        dag_error("no node", "");
+
+    // 2. Operands and edges (operands may name nodes defined later)
+    int i = 0;
+    for(cursor = description; *cursor; ){
+        size_t length = strcspn(cursor, "\n");
+        char   operands[2][MAX_LINE];
+
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        cursor += length + (cursor[length] == '\n');
+        if(strspn(line, " \t") == length)
+            continue;
+
+        sscanf(line, "%*s %511s %511s", operands[0], operands[1]);
+        for(int k = 0; k < 2; k++){
+            struct node* node = &dag->nodes[i];
+            char*        save;
+            for(char* name = strtok_r(operands[k], "+", &save); name != NULL;
+                name = strtok_r(NULL, "+", &save)){
+                if(node->nb_terms[k] == MAX_TERMS)
+                    dag_error("too many operands", line);
+                int operand = dag_operand(dag, dag->nb_nodes, name, line);
+                node->term[k][node->nb_terms[k]++] = operand;
+                if(operand >= 0)
+                    dag_add_succ(dag, operand, i);
+            }
+            if(node->nb_terms[k] == 0)
+                dag_error("missing operand", line);
+        }
+        for(int j = 0; j < i; j++)
+            if(strcmp(dag->nodes[j].name, dag->nodes[i].name) == 0)
+                dag_error("duplicate node", line);
+        i++;
+    }
+
+    dag->order = malloc(dag->nb_nodes * sizeof(int));
+    dag->heap  = malloc(dag->nb_nodes * sizeof(int));
+    dag_rank(dag);
+    omp_init_lock(&dag->lock);
+}
+
+// dag_free function: release the memory of "dag"
+void dag_free(struct dag* dag){
+    for(int i = 0; i < dag->nb_nodes; i++)
+        free(dag->nodes[i].succs);
+    free(dag->nodes);
+    free(dag->order);
+    free(dag->heap);
+    omp_destroy_lock(&dag->lock);
+}
+
+// dag_operand_sum function: return the value of x (k = 0) or y (k = 1)
+// of "node", once its predecessors are done
+double dag_operand_sum(const struct dag* dag, const struct node* node, int k){
+    double sum = 0;
+
+    for(int t = 0; t < node->nb_terms[k]; t++){
+        int operand = node->term[k][t];
+        double value = operand >= 0 ? dag->nodes[operand].value
+                                    : dag->inputs[-1 - operand];
+        sum = t ? sum + value : value;
+    }
+    return sum;
+}
+
+// dag_compute function: compute "node", i.e. f with its cost scaled to
+// the time unit of the dag
+void dag_compute(const struct dag* dag, struct node* node){
+    double          seconds = node->cost * dag->time_unit;
+    struct timespec duration;
+
+    duration.tv_sec  = (time_t) seconds;
+    duration.tv_nsec = (long) ((seconds - duration.tv_sec) * 1e9);
+    nanosleep(&duration, NULL);
+    node->value = f(dag_operand_sum(dag, node, 0),
+                    dag_operand_sum(dag, node, 1), 0);
+}
+
+// heap_higher function: return 1 if node i has priority over node j
+int heap_higher(const struct dag* dag, int i, int j){
+    if(dag->nodes[i].rank != dag->nodes[j].rank)
+        return dag->nodes[i].rank > dag->nodes[j].rank;
+    return i < j;
+}
+
+// heap_push function: add the ready node "i" (lock held)
+void heap_push(struct dag* dag, int i){
+    int position = dag->heap_size++;
+
+    while(position > 0 &&
+          heap_higher(dag, i, dag->heap[(position - 1) / 2])){
+        dag->heap[position] = dag->heap[(position - 1) / 2];
+        position = (position - 1) / 2;
+    }
+    dag->heap[position] = i;
+}
+
+// heap_pop function: remove and return the ready node of highest rank
+// (lock held, heap not empty)
+int heap_pop(struct dag* dag){
+    int top = dag->heap[0];
+    int last = dag->heap[--dag->heap_size];
+    int position = 0;
+
+    for(;;){
+        int child = 2 * position + 1;
+        if(child >= dag->heap_size)
+            break;
+        if(child + 1 < dag->heap_size &&
+           heap_higher(dag, dag->heap[child + 1], dag->heap[child]))
+            child++;
+        if(!heap_higher(dag, dag->heap[child], last))
+            break;
+        dag->heap[position] = dag->heap[child];
+        position = child;
+    }
+    dag->heap[position] = last;
+    return top;
+}
+
+// dag_ready function: make node "i" ready and spawn the task running it
+// (or, as tasks take the best ready node, a node of higher rank)
+void dag_run_ready(struct dag* dag);
+
+void dag_ready(struct dag* dag, int i){
+    omp_set_lock(&dag->lock);
+    heap_push(dag, i);
+    omp_unset_lock(&dag->lock);
+
+    #pragma omp task
+    dag_run_ready(dag);
+}
+
+// dag_run_ready function: run the ready node of highest rank, then make
+// ready its successors whose predecessors are all done
+void dag_run_ready(struct dag* dag){
+    struct node* node;
+
+    omp_set_lock(&dag->lock);
+    node = &dag->nodes[heap_pop(dag)];
+    omp_unset_lock(&dag->lock);
+
+    dag_compute(dag, node);
+
+    for(int s = 0; s < node->nb_succs; s++){
+        int pending;
+        #pragma omp atomic capture seq_cst
+        pending = --dag->nodes[node->succs[s]].pending;
+        if(pending == 0)
+            dag_ready(dag, node->succs[s]);
+    }
+}
+
+// dag_execute function: execute "dag" with all the threads
+void dag_execute(struct dag* dag){
+    for(int i = 0; i < dag->nb_nodes; i++)
+        dag->nodes[i].pending = dag->nodes[i].nb_preds;
+    dag->heap_size = 0;
+
+    #pragma omp parallel
     {
-        #pragma omp section
+        #pragma omp single
         {
-            #pragma omp task
-            d1 = f(r1, r2, 1);
+            // (whatever their order, tasks run the sources of highest rank)
+            for(int i = 0; i < dag->nb_nodes; i++)
+                if(dag->nodes[dag->order[i]].nb_preds == 0)
+                    dag_ready(dag, dag->order[i]);
+        }
+    }
+}
 
-            #pragma omp task
-            d2 = f(r2, r3, 1);
-            
-            #pragma omp taskwait
+// dag_execute_sequential function: execute "dag" in topological order
+void dag_execute_sequential(struct dag* dag){
+    for(int i = 0; i < dag->nb_nodes; i++)
+        dag_compute(dag, &dag->nodes[dag->order[i]]);
+}
 
-            #pragma omp task
-            d3 = f(d1, d2, 1);
+// dag_lower_bound function: return the makespan lower bound of "dag" on
+// "threads" threads in seconds: its critical path, or its work divided
+// among the threads
+double dag_lower_bound(const struct dag* dag, int threads){
+    double bound = dag->critical_path;
 
-            #pragma omp task
-            d5 = f(r2, d2, 1);
-        }
-        
-        #pragma omp section
-        d4 = f(r1, r3, 2);
+    if(dag->total_cost / threads > bound)
+        bound = dag->total_cost / threads;
+    return bound * dag->time_unit;
+}
 
+// dag_generate function: return the description of a random layered DAG
+// of "nb_nodes" (>= 1) nodes on the inputs r1..r3 (to be freed), every
+// node using one node of the previous layer and one or two of any earlier
+// layer
+char* dag_generate(int nb_nodes, unsigned int seed){
+    int   layers = (int) sqrt(nb_nodes);
+
+    if(layers < 1) layers = 1;
+    int*  begin = malloc((layers + 1) * sizeof(int));
+    char* description = malloc((size_t) nb_nodes * 64 + 1);
+    char* end = description;
+
+    if(begin == NULL || description == NULL){
+        fprintf(stderr, "out of memory (%d nodes)\n", nb_nodes);
+        exit(1);
     }
-    
-    d6 = f(d5, d4 + d3, 1);
+    for(int l = 0; l <= layers; l++)
+        begin[l] = (int) ((long) l * nb_nodes / layers);
 
-    *r = d6;
+    *end = '\0';
+    for(int l = 0; l < layers; l++)
+        for(int i = begin[l]; i < begin[l + 1]; i++){
+            int cost = 1 + rand_r(&seed) % GEN_COST;
+            if(l == 0){
+                end += sprintf(end, "n%d r%d r%d %d\n", i,
+                               1 + rand_r(&seed) % 3, 1 + rand_r(&seed) % 3,
+                               cost);
+                continue;
+            }
+            int x = begin[l - 1] + rand_r(&seed) % (begin[l] - begin[l - 1]);
+            end += sprintf(end, "n%d n%d n%d", i, x,
+                           rand_r(&seed) % begin[l]);
+            if(rand_r(&seed) % 2)
+                end += sprintf(end, "+n%d", rand_r(&seed) % begin[l]);
+            end += sprintf(end, " %d\n", cost);
+        }
+
+    free(begin);
+    return description;
 }
 
-int main() {
-    double val_ref, val_ker;
+// Computation kernel: the reference graph, described as data. Its critical
+// path d2 -> d3 -> d6 (or d4 -> d6) gives a 3 s lower bound.
+
+const char* dag_description =
+    "d1 r1 r2    1\n"
+    "d2 r2 r3    1\n"
+    "d3 d1 d2    1\n"
+    "d4 r1 r3    2\n"
+    "d5 r2 d2    1\n"
+    "d6 d5 d4+d3 1\n";
+
+void dag_kernel(double r1, double r2, double r3, double* r, double* bound) {
+    double     inputs[3] = {r1, r2, r3};
+    struct dag dag;
+
+    dag_build(&dag, dag_description, inputs, 3, 1.0);
+    dag_execute(&dag);
+
+    *r     = dag.nodes[dag.nb_nodes - 1].value;
+    *bound = dag_lower_bound(&dag, omp_get_max_threads());
+    dag_free(&dag);
+}
+
+// generated function: compare the sequential and parallel executions of
+// a random DAG of "nb_nodes" nodes (time unit: 1 ms)
+void generated(int nb_nodes, unsigned int seed) {
+    double     inputs[3] = {1, 2, 3};
+    double     time_sequential, time_parallel;
+    char*      description = dag_generate(nb_nodes, seed);
+    struct dag dag;
+
+    dag_build(&dag, description, inputs, 3, 1e-3);
+    free(description);
+
+    dag_execute_sequential(&dag);
+    double* values = malloc(dag.nb_nodes * sizeof(double));
+    for(int i = 0; i < dag.nb_nodes; i++)
+        values[i] = dag.nodes[i].value;
+    time_sequential = dag.total_cost * dag.time_unit;
+
+    time_parallel = omp_get_wtime();
+    dag_execute(&dag);
+    time_parallel = omp_get_wtime() - time_parallel;
+
+    printf("Nodes          : %d (%d threads)\n", dag.nb_nodes,
+           omp_get_max_threads());
+    printf("Sequential     : %3.5lf s (work)\n", time_sequential);
+    printf("Critical path  : %3.5lf s\n", dag.critical_path * dag.time_unit);
+    printf("Makespan       : %3.5lf s\n", time_parallel);
+    printf("Lower bound    : %3.5lf s (%.1lf%% of the makespan)\n",
+           dag_lower_bound(&dag, omp_get_max_threads()),
+           100 * dag_lower_bound(&dag, omp_get_max_threads()) / time_parallel);
+
+    for(int i = 0; i < dag.nb_nodes; i++)
+        if(values[i] != dag.nodes[i].value) {
+            printf("Bad results :-(((\n");
+            exit(1);
+        }
+    printf("OK results :-)\n");
+    free(values);
+    dag_free(&dag);
+}
+
+int main(int argc, char* argv[]) {
+    double val_ref, val_ker, bound;
     double time_reference, time_kernel;
+
+    int nodes = (argc > 1) ? atoi(argv[1]) : 0;
+
+    if(argc > 3 || (argc > 1 && nodes <= 0)) {
+        fprintf(stderr, "usage: %s [nodes [seed]] (nodes > 0)\n", argv[0]);
+        exit(1);
+    }
+    if(argc > 1) {
+        generated(nodes, argc > 2 ? atoi(argv[2]) : 1);
+        return 0;
+    }
+
     // Initialization by random values
     srand((unsigned int) time(NULL));
     double val1 = (double) rand() / (double) (RAND_MAX / MAX_VAL);
@@ -73,9 +504,10 @@ int main() {
     printf("Reference time : %3.5lf s\n", time_reference);
 
     time_kernel = omp_get_wtime();
-    dag_kernel(val1, val2, val3, &val_ker);
+    dag_kernel(val1, val2, val3, &val_ker, &bound);
     time_kernel = omp_get_wtime() - time_kernel;
     printf("Kernel time    : %3.5lf s\n", time_kernel);
+    printf("Lower bound    : %3.5lf s\n", bound);
 
     printf("Speedup        : %3.5lf\n", time_reference / time_kernel);
 
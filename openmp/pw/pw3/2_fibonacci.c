@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include "../../dac.h"
 
 // -------------------------------------------------------
 // Reference computation part (do not touch)
@@ -20,39 +21,58 @@ void fibonacci_reference(int n, int* fibo) {
 // -------------------------------------------------------
 // Computation kernel (to parallelize)
 
-int initial;
+// The recursion is run by the divide-and-conquer skeleton: fib(n) is
+// divided into fib(n - 1) and fib(n - 2) for the first levels (depth
+// cutoff, from the number of threads), deeper calls are sequential.
 
 int fibok(int n){
     if(n < 2)
         return n;
 
-    if(n < initial / 2)
-        return fibok(n - 1) + fibok(n - 2);
+    return fibok(n - 1) + fibok(n - 2);
+}
 
-    int f1, f2;
+struct fib_problem {
+    int n;
+    int result;
+};
 
-    #pragma omp task shared(f1)
-    f1 = fibok(n - 1);
+int fib_divide(void* problem, void* children){
+    struct fib_problem* p = problem;
+    struct fib_problem* c = children;
 
-    #pragma omp task shared(f2)
-    f2 = fibok(n - 2);
+    if(p->n < 2)
+        return 0;
+    c[0].n = p->n - 1;
+    c[1].n = p->n - 2;
+    return 2;
+}
 
-    #pragma omp taskwait
+void fib_combine(void* problem, void* children, int nb_children){
+    struct fib_problem* p = problem;
+    struct fib_problem* c = children;
 
-    return f1 + f2;
+    (void) nb_children;
+    p->result = c[0].result + c[1].result;
 }
 
-void fibonacci_kernel(int n, int *fibo){
+void fib_solve(void* problem){
+    struct fib_problem* p = problem;
+
+    p->result = fibok(p->n);
+}
 
-    initial = n;
+const struct dac_ops fib_ops = {
+    sizeof(struct fib_problem), fib_divide, fib_combine, fib_solve, NULL
+};
 
-    #pragma omp parallel
-    {
-        #pragma omp single
-        {
-            *fibo = fibok(n);
-        }
-    }
+void fibonacci_kernel(int n, int *fibo){
+    struct fib_problem problem = {n, 0};
+    struct dac         dac;
+
+    dac_init(&dac, &fib_ops, DAC_CUTOFF_DEPTH);
+    dac_run(&dac, &problem);
+    *fibo = problem.result;
 }
 
 // -------------------------------------------------------
@@ -0,0 +1,470 @@
+#include <omp.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../dac.h"
+
+#define KARATSUBA_LIMBS 32        // products below this size are schoolbook
+#define TASK_LIMBS      2048      // products below this size are sequential
+#define REFERENCE_MAX   40        // largest n for the recursive reference
+#define ITERATIVE_MAX   200000    // largest n for the iterative check
+#define PRINT_MAX       1000      // largest n printed in full
+#define CHECK_PRIME     1000000007ULL
+
+// -------------------------------------------------------
+// Reference computation part (do not touch)
+
+int fibor(int n) {
+    if(n < 2) return n;
+
+    return fibor(n - 1) + fibor(n - 2);
+}
+
+// -------------------------------------------------------
+// Arbitrary precision integers: little-endian arrays of 32-bit limbs,
+// "len" is the number of significant limbs (0 for zero)
+
+struct big {
+    uint32_t* limb;
+    size_t    len;
+};
+
+// big_new function: return a zero of "cap" limbs of capacity
+struct big big_new(size_t cap){
+    struct big x;
+
+    x.limb = calloc(cap ? cap : 1, sizeof(uint32_t));
+    x.len  = 0;
+    if(x.limb == NULL){
+        fprintf(stderr, "out of memory (%zu limbs)\n", cap);
+        exit(1);
+    }
+    return x;
+}
+
+// big_trim function: drop the leading zero limbs of "x"
+void big_trim(struct big* x){
+    while(x->len > 0 && x->limb[x->len - 1] == 0)
+        x->len--;
+}
+
+// limb_add function: x[0..xlen) += y[0..ylen) with ylen <= xlen, return
+// the carry out of x
+uint32_t limb_add(uint32_t* x, size_t xlen, const uint32_t* y, size_t ylen){
+    uint64_t carry = 0;
+    size_t   i;
+
+    for(i = 0; i < ylen; i++){
+        carry += (uint64_t) x[i] + y[i];
+        x[i]   = (uint32_t) carry;
+        carry >>= 32;
+    }
+    for(; carry && i < xlen; i++){
+        carry += x[i];
+        x[i]   = (uint32_t) carry;
+        carry >>= 32;
+    }
+    return (uint32_t) carry;
+}
+
+// limb_sub function: x[0..xlen) -= y[0..ylen) with ylen <= xlen and
+// x >= y
+void limb_sub(uint32_t* x, size_t xlen, const uint32_t* y, size_t ylen){
+    int64_t borrow = 0;
+    size_t  i;
+
+    for(i = 0; i < ylen; i++){
+        borrow += (int64_t) x[i] - y[i];
+        x[i]    = (uint32_t) borrow;
+        borrow  = borrow < 0 ? -1 : 0;
+    }
+    for(; borrow && i < xlen; i++){
+        borrow += x[i];
+        x[i]    = (uint32_t) borrow;
+        borrow  = borrow < 0 ? -1 : 0;
+    }
+}
+
+// big_add function: return x + y
+struct big big_add(const struct big* x, const struct big* y){
+    const struct big* longer  = x->len >= y->len ? x : y;
+    const struct big* shorter = x->len >= y->len ? y : x;
+    struct big        sum     = big_new(longer->len + 1);
+
+    memcpy(sum.limb, longer->limb, longer->len * sizeof(uint32_t));
+    sum.limb[longer->len] = limb_add(sum.limb, longer->len,
+                                     shorter->limb, shorter->len);
+    sum.len = longer->len + 1;
+    big_trim(&sum);
+    return sum;
+}
+
+// big_sub function: return x - y (x >= y)
+struct big big_sub(const struct big* x, const struct big* y){
+    struct big difference = big_new(x->len);
+
+    memcpy(difference.limb, x->limb, x->len * sizeof(uint32_t));
+    limb_sub(difference.limb, x->len, y->limb, y->len);
+    difference.len = x->len;
+    big_trim(&difference);
+    return difference;
+}
+
+// big_mod function: return x mod "m" (m < 2^32)
+uint64_t big_mod(const struct big* x, uint64_t m){
+    uint64_t r = 0;
+
+    for(size_t i = x->len; i-- > 0;)
+        r = ((r << 32) | x->limb[i]) % m;
+    return r;
+}
+
+// big_low64 function: return x mod 2^64
+uint64_t big_low64(const struct big* x){
+    uint64_t low = 0;
+
+    if(x->len > 0) low = x->limb[0];
+    if(x->len > 1) low |= (uint64_t) x->limb[1] << 32;
+    return low;
+}
+
+// big_print function: print "x" in decimal (by repeated divisions by 10^9,
+// quadratic: for small numbers only)
+void big_print(const struct big* x){
+    struct big q      = big_new(x->len);
+    size_t     groups = 0;
+    uint32_t*  digits = malloc((x->len * 10 / 9 + 2) * sizeof(uint32_t));
+
+    memcpy(q.limb, x->limb, x->len * sizeof(uint32_t));
+    q.len = x->len;
+    do{
+        uint64_t r = 0;
+        for(size_t i = q.len; i-- > 0;){
+            uint64_t current = (r << 32) | q.limb[i];
+            q.limb[i] = (uint32_t) (current / 1000000000);
+            r         = current % 1000000000;
+        }
+        digits[groups++] = (uint32_t) r;
+        big_trim(&q);
+    }while(q.len > 0);
+
+    printf("%u", digits[groups - 1]);
+    while(groups-- > 1)
+        printf("%09u", digits[groups - 1]);
+    free(digits);
+    free(q.limb);
+}
+
+// -------------------------------------------------------
+// Karatsuba multiplication on the divide-and-conquer skeleton: the product
+// r[0..2n) of a[0..n) and b[0..n) is divided, with m = n/2 and h = n - m,
+// into z0 = a0.b0 (stored in r[0..2m)), z2 = a1.b1 (stored in r[2m..2n))
+// and z1 = (a0 + a1)(b0 + b1) (stored in scratch space), then combined as
+// r += (z1 - z0 - z2) << 32m. The three products are independent tasks
+// down to TASK_LIMBS limbs (size cutoff), then sequential.
+
+struct mul_problem {
+    const uint32_t* a;
+    const uint32_t* b;
+    uint32_t*       r;
+    size_t          n;
+    uint32_t*       scratch;    // a0 + a1, b0 + b1 and z1 (4h + 4 limbs)
+};
+
+// schoolbook function: r[0..2n) = a[0..n) * b[0..n)
+void schoolbook(const uint32_t* a, const uint32_t* b, uint32_t* r, size_t n){
+    memset(r, 0, 2 * n * sizeof(uint32_t));
+    for(size_t i = 0; i < n; i++){
+        uint64_t carry = 0;
+        for(size_t j = 0; j < n; j++){
+            carry   += (uint64_t) a[i] * b[j] + r[i + j];
+            r[i + j] = (uint32_t) carry;
+            carry  >>= 32;
+        }
+        r[i + n] = (uint32_t) carry;
+    }
+}
+
+int mul_divide(void* problem, void* children){
+    struct mul_problem* p = problem;
+    struct mul_problem* c = children;
+    size_t              m = p->n / 2, h = p->n - m;
+
+    if(p->n < KARATSUBA_LIMBS)
+        return 0;
+
+    p->scratch = malloc((4 * h + 4) * sizeof(uint32_t));
+    if(p->scratch == NULL){
+        fprintf(stderr, "out of memory (%zu limbs)\n", 4 * h + 4);
+        exit(1);
+    }
+    uint32_t* sa = p->scratch;
+    uint32_t* sb = sa + h + 1;
+
+    memcpy(sa, p->a + m, h * sizeof(uint32_t));
+    sa[h] = limb_add(sa, h, p->a, m);
+    memcpy(sb, p->b + m, h * sizeof(uint32_t));
+    sb[h] = limb_add(sb, h, p->b, m);
+
+    c[0] = (struct mul_problem) {p->a, p->b, p->r, m, NULL};
+    c[1] = (struct mul_problem) {p->a + m, p->b + m, p->r + 2 * m, h, NULL};
+    c[2] = (struct mul_problem) {sa, sb, sb + h + 1, h + 1, NULL};
+    return 3;
+}
+
+void mul_combine(void* problem, void* children, int nb_children){
+    struct mul_problem* p  = problem;
+    struct mul_problem* c  = children;
+    size_t              m  = p->n / 2, h = p->n - m;
+    uint32_t*           z1 = c[2].r;
+    size_t              z1_len = 2 * h + 2;
+
+    (void) nb_children;
+    limb_sub(z1, z1_len, p->r, 2 * m);
+    limb_sub(z1, z1_len, p->r + 2 * m, 2 * h);
+    // z1 - z0 - z2 < 2^(64h) + ..., its top limbs beyond r are zero
+    while(z1_len > 2 * p->n - m)
+        z1_len--;
+    limb_add(p->r + m, 2 * p->n - m, z1, z1_len);
+    free(p->scratch);
+}
+
+void mul_solve(void* problem){
+    struct mul_problem* p = problem;
+    struct mul_problem  children[3];
+
+    if(mul_divide(p, children) == 0){
+        schoolbook(p->a, p->b, p->r, p->n);
+        return;
+    }
+    for(int i = 0; i < 3; i++)
+        mul_solve(&children[i]);
+    mul_combine(p, children, 3);
+}
+
+size_t mul_size(const void* problem){
+    return ((const struct mul_problem*) problem)->n;
+}
+
+const struct dac_ops mul_ops = {
+    sizeof(struct mul_problem), mul_divide, mul_combine, mul_solve, mul_size
+};
+
+// big_mul function: return x * y, the operands being zero-extended to the
+// same number of limbs
+struct big big_mul(const struct big* x, const struct big* y){
+    size_t     n       = x->len >= y->len ? x->len : y->len;
+    struct big product = big_new(2 * n);
+    uint32_t*  a       = calloc(n ? 2 * n : 1, sizeof(uint32_t));
+    uint32_t*  b       = a + n;
+
+    if(n == 0){
+        free(a);
+        return product;
+    }
+    memcpy(a, x->limb, x->len * sizeof(uint32_t));
+    memcpy(b, y->limb, y->len * sizeof(uint32_t));
+
+    struct mul_problem problem = {a, b, product.limb, n, NULL};
+    struct dac         dac;
+
+    dac_init(&dac, &mul_ops, DAC_CUTOFF_SIZE);
+    dac.min_size = TASK_LIMBS;
+    dac_run(&dac, &problem);
+
+    free(a);
+    product.len = 2 * n;
+    big_trim(&product);
+    return product;
+}
+
+// -------------------------------------------------------
+// Computation kernel: fast doubling, from (a, b) = (F(k), F(k+1)):
+//   F(2k)   = a (2b - a)
+//   F(2k+1) = a^2 + b^2
+// following the bits of n from the most significant one, i.e. O(log n)
+// steps whose (up to three) products are computed in parallel tasks, each
+// product being itself parallel. The last step only computes F(n).
+
+void fibonacci_big(unsigned long n, struct big* fibo){
+    struct big a = big_new(1), b = big_new(1);
+    int        top = 0;
+
+    b.limb[0] = 1;
+    b.len     = 1;
+    while(top < 63 && (n >> (top + 1)) != 0)
+        top++;
+
+    #pragma omp parallel
+    {
+        #pragma omp single
+        for(int bit = n ? top : -1; bit >= 0; bit--){
+            int        odd = (n >> bit) & 1, last = (bit == 0);
+            struct big twice_b_minus_a, c, a2, b2;
+
+            if(!last || !odd){
+                struct big b_minus_a = big_sub(&b, &a);
+                twice_b_minus_a = big_add(&b, &b_minus_a);
+                free(b_minus_a.limb);
+                #pragma omp task shared(c, a, twice_b_minus_a)
+                c = big_mul(&a, &twice_b_minus_a);
+            }
+            if(!last || odd){
+                #pragma omp task shared(a2, a)
+                a2 = big_mul(&a, &a);
+                #pragma omp task shared(b2, b)
+                b2 = big_mul(&b, &b);
+            }
+            #pragma omp taskwait
+
+            free(a.limb);
+            free(b.limb);
+            if(!last || !odd)
+                free(twice_b_minus_a.limb);
+            if(last && !odd){
+                a = c;
+                b = big_new(1);
+                continue;
+            }
+            struct big d = big_add(&a2, &b2);
+            free(a2.limb);
+            free(b2.limb);
+            if(last){
+                a = d;
+                b = big_new(1);
+            }
+            else if(odd){
+                a = d;
+                b = big_add(&c, &d);
+                free(c.limb);
+            }
+            else{
+                a = c;
+                b = d;
+            }
+        }
+    }
+
+    free(b.limb);
+    *fibo = a;
+}
+
+// -------------------------------------------------------
+// Checks: F(n) mod 2^64 and mod CHECK_PRIME, for any n, and for smaller n
+// the whole number by the linear (quadratic time) iteration
+
+uint64_t fibonacci_low64(unsigned long n){
+    uint64_t a = 0, b = 1;
+
+    for(unsigned long i = 0; i < n; i++){
+        uint64_t next = a + b;
+        a = b;
+        b = next;
+    }
+    return a;
+}
+
+uint64_t fibonacci_mod(unsigned long n, uint64_t p){
+    uint64_t a = 0, b = 1;
+
+    for(int bit = 63; bit >= 0; bit--){
+        uint64_t c = a * ((2 * b + p - a) % p) % p;
+        uint64_t d = (a * a + b * b) % p;
+        if((n >> bit) & 1){
+            a = d;
+            b = (c + d) % p;
+        }
+        else{
+            a = c;
+            b = d;
+        }
+    }
+    return a;
+}
+
+void fibonacci_iterative(unsigned long n, struct big* fibo){
+    struct big a = big_new(1), b = big_new(1);
+
+    b.limb[0] = 1;
+    b.len     = 1;
+    for(unsigned long i = 0; i < n; i++){
+        struct big next = big_add(&a, &b);
+        free(a.limb);
+        a = b;
+        b = next;
+    }
+    free(b.limb);
+    *fibo = a;
+}
+
+int main(int argc, char* argv[]) {
+    double        time_reference, time_iterative, time_kernel;
+    unsigned long n;
+    struct big    fibo;
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s number\n", argv[0]);
+        exit(1);
+    }
+    n = strtoul(argv[1], NULL, 10);
+
+    time_kernel = omp_get_wtime();
+    fibonacci_big(n, &fibo);
+    time_kernel = omp_get_wtime() - time_kernel;
+    printf("Kernel time    : %3.5lf s\n", time_kernel);
+
+    if(n <= REFERENCE_MAX) {
+        int fibo_ref;
+
+        time_reference = omp_get_wtime();
+        fibo_ref = fibor((int) n);
+        time_reference = omp_get_wtime() - time_reference;
+        printf("Reference time : %3.5lf s\n", time_reference);
+        printf("Speedup        : %3.5lf\n", time_reference / time_kernel);
+        if(big_low64(&fibo) != (uint64_t) fibo_ref) {
+            printf("Bad results :-(((\n");
+            exit(1);
+        }
+    }
+
+    if(n <= ITERATIVE_MAX) {
+        struct big fibo_it;
+
+        time_iterative = omp_get_wtime();
+        fibonacci_iterative(n, &fibo_it);
+        time_iterative = omp_get_wtime() - time_iterative;
+        printf("Iterative time : %3.5lf s\n", time_iterative);
+        printf("Speedup (it.)  : %3.5lf\n", time_iterative / time_kernel);
+        if(fibo_it.len != fibo.len ||
+           memcmp(fibo_it.limb, fibo.limb, fibo.len * sizeof(uint32_t))) {
+            printf("Bad results :-(((\n");
+            exit(1);
+        }
+        free(fibo_it.limb);
+    }
+
+    if(big_low64(&fibo) != fibonacci_low64(n) ||
+       big_mod(&fibo, CHECK_PRIME) != fibonacci_mod(n, CHECK_PRIME)) {
+        printf("Bad results :-(((\n");
+        exit(1);
+    }
+
+    if(n <= PRINT_MAX) {
+        printf("fibo(%lu) = ", n);
+        big_print(&fibo);
+        printf("\n");
+    }
+    else {
+        // digits of F(n) ~ phi^n / sqrt(5)
+        double digits = n * log10((1 + sqrt(5)) / 2) - log10(sqrt(5));
+        printf("fibo(%lu) = ...%09llu (%.0f digits, %zu limbs)\n", n,
+               (unsigned long long) big_mod(&fibo, 1000000000), floor(digits) + 1,
+               fibo.len);
+    }
+    printf("OK results :-)\n");
+
+    free(fibo.limb);
+    return 0;
+}
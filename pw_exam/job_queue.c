@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+#define DEQUE_SIZE   4096       // jobs per worker deque (power of 2)
+#define QUEUE_SIZE   65536      // jobs in the submission queue (power of 2)
+#define TRANSFER     32         // jobs taken from the submission queue at once
+#define SPIN_ROUNDS  64         // idle rounds spinning before yielding
+#define YIELD_ROUNDS 16         // idle rounds yielding before parking
+#define PARK_NS      1000000    // longest parking of an idle worker (ns)
+#define SUBMIT_AHEAD 256        // queued jobs beyond which a submitter yields
+#define CACHE_LINE   64
+
+#define BENCH_JOBS      1000000 // jobs of the benchmark (-j)
+#define BENCH_WORK      100     // work units of a job (-w)
+#define BENCH_PRODUCERS 2       // threads submitting jobs (-p)
+                                // workers (-t): the cores left to producers
+
+/* ------------------------------------------------------------------------ *
+ *                    STREAMING WORK-STEALING JOB RUNTIME                   *
+ * ------------------------------------------------------------------------ *
+ * A fixed set of worker threads runs jobs as they are submitted, for as
+ * long as the runtime lives. External threads submit to a lock-free
+ * multi-producer multi-consumer queue, so there is no single producer;
+ * jobs submitted by a job go to its worker's own Chase-Lev deque. An idle
+ * worker pops its deque, then takes a batch from the submission queue
+ * (which others can then steal), then steals from random victims, and
+ * finally spins, yields and parks on a condition variable; a submission
+ * wakes a parked worker. When the submitters run ahead of the workers (as
+ * when threads outnumber the cores and a submitter would otherwise hold
+ * the core for a whole scheduler quantum), a submitter yields once
+ * SUBMIT_AHEAD jobs are queued. Jobs can be counted in a group, to wait
+ * for them.
+ */
+
+typedef void (*job_fn)(void*);
+
+// jobs submitted and not finished yet
+struct group {
+  atomic_long pending;
+};
+
+struct job {
+  job_fn fn;
+  void* arg;
+  struct group* group;
+};
+
+// A deque slot is read by thieves while its owner may overwrite it: the
+// fields are atomics read and written relaxed (a torn read is harmless, as
+// the thief's compare-and-swap on "top" then fails).
+struct slot {
+  _Atomic(job_fn) fn;
+  _Atomic(void*) arg;
+  _Atomic(struct group*) group;
+};
+
+// Chase-Lev deque (fixed size): the owner pushes and pops at the bottom,
+// thieves steal at the top. Memory orders follow Le et al., "Correct and
+// efficient work-stealing for weak memory models" (PPoPP 2013).
+struct deque {
+  _Alignas(CACHE_LINE) atomic_long top;
+  _Alignas(CACHE_LINE) atomic_long bottom;
+  struct slot slots[DEQUE_SIZE];
+};
+
+// Bounded MPMC queue (D. Vyukov): the sequence number of a cell tells
+// whether it is free for the producer of position "pos" (sequence == pos)
+// or full for its consumer (sequence == pos + 1).
+struct cell {
+  atomic_size_t sequence;
+  struct job job;
+};
+
+struct queue {
+  _Alignas(CACHE_LINE) atomic_size_t head;  // next position to fill
+  _Alignas(CACHE_LINE) atomic_size_t tail;  // next position to empty
+  _Alignas(CACHE_LINE) struct cell cells[QUEUE_SIZE];
+};
+
+struct runtime;
+
+struct worker {
+  struct deque deque;
+  struct runtime* runtime;
+  pthread_t thread;
+  unsigned seed;                // victim selection
+};
+
+struct runtime {
+  struct queue* queue;
+  struct worker* workers;
+  int nb_workers;
+  atomic_int stop;
+  atomic_int sleepers;          // parked (or parking) workers
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+};
+
+// worker of the calling thread (NULL outside of the workers)
+static _Thread_local struct worker* current_worker = NULL;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static inline void slot_store(struct slot* slot, struct job job) {
+  atomic_store_explicit(&slot->fn, job.fn, memory_order_relaxed);
+  atomic_store_explicit(&slot->arg, job.arg, memory_order_relaxed);
+  atomic_store_explicit(&slot->group, job.group, memory_order_relaxed);
+}
+
+static inline void slot_load(struct slot* slot, struct job* job) {
+  job->fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+  job->arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+  job->group = atomic_load_explicit(&slot->group, memory_order_relaxed);
+}
+
+// Push a job at the bottom (owner only), return 0 if the deque is full.
+int deque_push(struct deque* q, struct job job) {
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+
+  if (b - t >= DEQUE_SIZE)
+    return 0;
+  slot_store(&q->slots[b & (DEQUE_SIZE - 1)], job);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  return 1;
+}
+
+// Pop a job from the bottom (owner only), return 0 if there is none.
+int deque_pop(struct deque* q, struct job* job) {
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  long t;
+  int found = 1;
+
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  t = atomic_load_explicit(&q->top, memory_order_relaxed);
+  if (t > b) {
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return 0;
+  }
+  slot_load(&q->slots[b & (DEQUE_SIZE - 1)], job);
+  if (t == b) {
+    // last job: race against the thieves for it
+    found = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                    memory_order_seq_cst,
+                                                    memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return found;
+}
+
+// Steal a job from the top, return 0 if there is none (or if another
+// thief won it).
+int deque_steal(struct deque* q, struct job* job) {
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  if (t >= b)
+    return 0;
+  slot_load(&q->slots[t & (DEQUE_SIZE - 1)], job);
+  return atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed);
+}
+
+void queue_init(struct queue* q) {
+  for (size_t i = 0; i < QUEUE_SIZE; i++)
+    atomic_init(&q->cells[i].sequence, i);
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+}
+
+// Enqueue a job, return 0 if the queue is full.
+int queue_push(struct queue* q, struct job job) {
+  size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  while (1) {
+    struct cell* cell = &q->cells[pos & (QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&cell->sequence,
+                                           memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        cell->job = job;
+        atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+  }
+}
+
+// Number of queued jobs (approximate).
+size_t queue_length(struct queue* q) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  return (head > tail) ? head - tail : 0;
+}
+
+// Dequeue a job, return 0 if the queue is empty.
+int queue_pop(struct queue* q, struct job* job) {
+  size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  while (1) {
+    struct cell* cell = &q->cells[pos & (QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&cell->sequence,
+                                           memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        *job = cell->job;
+        atomic_store_explicit(&cell->sequence, pos + QUEUE_SIZE,
+                              memory_order_release);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+  }
+}
+
+void run_job(struct job job) {
+  job.fn(job.arg);
+  if (job.group != NULL)
+    atomic_fetch_sub_explicit(&job.group->pending, 1, memory_order_release);
+}
+
+// Find a job for worker "w": own deque, then a batch of the submission
+// queue (the rest of the batch goes to the own deque), then stealing.
+int find_job(struct worker* w, struct job* job) {
+  struct runtime* rt = w->runtime;
+  struct job extra;
+
+  if (deque_pop(&w->deque, job))
+    return 1;
+
+  if (queue_pop(rt->queue, job)) {
+    for (int i = 1; i < TRANSFER && queue_pop(rt->queue, &extra); i++) {
+      if (!deque_push(&w->deque, extra)) {
+        run_job(extra);
+        break;
+      }
+    }
+    return 1;
+  }
+
+  int first = rand_r(&w->seed) % rt->nb_workers;
+  for (int i = 0; i < rt->nb_workers; i++) {
+    struct worker* victim = &rt->workers[(first + i) % rt->nb_workers];
+    if (victim != w && deque_steal(&victim->deque, job))
+      return 1;
+  }
+  return 0;
+}
+
+// Return 1 if some job may be waiting (approximate, for parking).
+int runtime_has_work(struct runtime* rt) {
+  if (atomic_load(&rt->queue->head) != atomic_load(&rt->queue->tail))
+    return 1;
+  for (int i = 0; i < rt->nb_workers; i++)
+    if (atomic_load(&rt->workers[i].deque.bottom) >
+        atomic_load(&rt->workers[i].deque.top))
+      return 1;
+  return 0;
+}
+
+// Park an idle worker until a submission wakes it up. The sleeper count is
+// raised before the last check for work and submitters check it after
+// publishing their job (both with full fences), so a wake-up cannot be
+// lost; the timeout is only a safety net.
+void park(struct runtime* rt) {
+  struct timespec deadline;
+
+  pthread_mutex_lock(&rt->lock);
+  atomic_fetch_add(&rt->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!runtime_has_work(rt) && !atomic_load(&rt->stop)) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PARK_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&rt->wake, &rt->lock, &deadline);
+  }
+  atomic_fetch_sub(&rt->sleepers, 1);
+  pthread_mutex_unlock(&rt->lock);
+}
+
+void wake_one(struct runtime* rt) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&rt->sleepers, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&rt->lock);
+    pthread_cond_signal(&rt->wake);
+    pthread_mutex_unlock(&rt->lock);
+  }
+}
+
+// Idle backoff: spin, then yield (returns 1 once it is time to park).
+int backoff(int* idle) {
+  (*idle)++;
+  if (*idle < SPIN_ROUNDS) {
+    cpu_relax();
+    return 0;
+  }
+  if (*idle < SPIN_ROUNDS + YIELD_ROUNDS) {
+    sched_yield();
+    return 0;
+  }
+  *idle = 0;
+  return 1;
+}
+
+void* worker_main(void* arg) {
+  struct worker* w = arg;
+  struct runtime* rt = w->runtime;
+  struct job job;
+  int idle = 0;
+
+  current_worker = w;
+  while (!atomic_load_explicit(&rt->stop, memory_order_relaxed)) {
+    if (find_job(w, &job)) {
+      run_job(job);
+      idle = 0;
+    } else if (backoff(&idle)) {
+      park(rt);
+    }
+  }
+  return NULL;
+}
+
+// Start a runtime of "nb_workers" worker threads.
+struct runtime* runtime_create(int nb_workers) {
+  struct runtime* rt = malloc(sizeof(struct runtime));
+
+  rt->queue = aligned_alloc(CACHE_LINE, sizeof(struct queue));
+  queue_init(rt->queue);
+  rt->workers = aligned_alloc(CACHE_LINE, nb_workers * sizeof(struct worker));
+  rt->nb_workers = nb_workers;
+  atomic_init(&rt->stop, 0);
+  atomic_init(&rt->sleepers, 0);
+  pthread_mutex_init(&rt->lock, NULL);
+  pthread_cond_init(&rt->wake, NULL);
+
+  for (int i = 0; i < nb_workers; i++) {
+    struct worker* w = &rt->workers[i];
+    atomic_init(&w->deque.top, 0);
+    atomic_init(&w->deque.bottom, 0);
+    w->runtime = rt;
+    w->seed = i + 1;
+  }
+  for (int i = 0; i < nb_workers; i++)
+    pthread_create(&rt->workers[i].thread, NULL, worker_main, &rt->workers[i]);
+  return rt;
+}
+
+// Stop the workers (jobs still queued are dropped) and free the runtime.
+void runtime_destroy(struct runtime* rt) {
+  atomic_store(&rt->stop, 1);
+  pthread_mutex_lock(&rt->lock);
+  pthread_cond_broadcast(&rt->wake);
+  pthread_mutex_unlock(&rt->lock);
+  for (int i = 0; i < rt->nb_workers; i++)
+    pthread_join(rt->workers[i].thread, NULL);
+  pthread_mutex_destroy(&rt->lock);
+  pthread_cond_destroy(&rt->wake);
+  free(rt->queue);
+  free(rt->workers);
+  free(rt);
+}
+
+// Submit job fn(arg), counted in "group" if not NULL. Any thread may
+// submit; a full submission queue makes the submitter wait and a queue of
+// more than SUBMIT_AHEAD jobs makes it yield (back pressure), a full worker
+// deque makes the worker run the job at once.
+void runtime_submit(struct runtime* rt, struct group* group, job_fn fn,
+                    void* arg) {
+  struct job job = {fn, arg, group};
+  struct worker* w = current_worker;
+  int idle = 0;
+
+  if (group != NULL)
+    atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+  if (w != NULL && w->runtime == rt) {
+    if (!deque_push(&w->deque, job)) {
+      run_job(job);
+      return;
+    }
+  } else {
+    while (!queue_push(rt->queue, job))
+      if (backoff(&idle))
+        sched_yield();
+  }
+  wake_one(rt);
+  if (w == NULL && queue_length(rt->queue) > SUBMIT_AHEAD)
+    sched_yield();
+}
+
+// Wait until every job of "group" is finished. A worker runs jobs
+// meanwhile; another thread backs off.
+void runtime_wait(struct runtime* rt, struct group* group) {
+  struct worker* w = current_worker;
+  struct job job;
+  int idle = 0;
+
+  while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+    if (w != NULL && w->runtime == rt && find_job(w, &job)) {
+      run_job(job);
+      idle = 0;
+    } else if (backoff(&idle)) {
+      struct timespec pause = {0, PARK_NS / 100};
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------ *
+ *          BENCHMARK AGAINST THE omp single + omp task PATTERN             *
+ * ------------------------------------------------------------------------ */
+
+// submission and start dates of a benchmark job
+struct record {
+  double submitted;
+  double started;
+};
+
+int work = BENCH_WORK;
+
+void job_short(void* arg) {
+  struct record* record = arg;
+  volatile int sink = 0;
+
+  record->started = omp_get_wtime();
+  for (int i = 0; i < work; i++)
+    sink += i;
+}
+
+// compare function: compare two double values (qsort)
+int compare(const void* p1, const void* p2) {
+  double v1 = *(const double*) p1;
+  double v2 = *(const double*) p2;
+
+  return (v1 > v2) - (v1 < v2);
+}
+
+// Print the throughput and the submission-to-start latency distribution.
+void report(const char* name, struct record* records, int nb_jobs,
+            double time) {
+  double* latency = malloc(nb_jobs * sizeof(double));
+
+  for (int i = 0; i < nb_jobs; i++)
+    latency[i] = records[i].started - records[i].submitted;
+  qsort(latency, nb_jobs, sizeof(double), compare);
+  printf("%-28s %10.6lf s %10.3lf Mjobs/s   latency median %10.3lf us, "
+         "p99 %10.3lf us\n", name, time, nb_jobs / time / 1e6,
+         1e6 * latency[nb_jobs / 2],
+         1e6 * latency[(int) (0.99 * (nb_jobs - 1))]);
+  free(latency);
+}
+
+struct producer {
+  struct runtime* rt;
+  struct group* group;
+  struct record* records;
+  int first, last;
+};
+
+void* producer_main(void* arg) {
+  struct producer* p = arg;
+
+  for (int i = p->first; i < p->last; i++) {
+    p->records[i].submitted = omp_get_wtime();
+    runtime_submit(p->rt, p->group, job_short, &p->records[i]);
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int opt, nb_jobs = BENCH_JOBS, nb_producers = BENCH_PRODUCERS;
+  int nb_workers = 0, nb_cores = omp_get_num_procs();
+  double time;
+
+  while ((opt = getopt(argc, argv, "j:w:p:t:")) != -1) {
+    switch (opt) {
+      case 'j': nb_jobs = atoi(optarg); break;
+      case 'w': work = atoi(optarg); break;
+      case 'p': nb_producers = atoi(optarg); break;
+      case 't': nb_workers = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-j jobs] [-w work] [-p producers] "
+                        "[-t workers]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nb_workers == 0)
+    nb_workers = (nb_cores > nb_producers) ? nb_cores - nb_producers : 1;
+  if (nb_jobs <= 0 || work < 0 || nb_producers <= 0 || nb_workers <= 0) {
+    fprintf(stderr, "Error: invalid parameters\n");
+    return 1;
+  }
+
+  struct record* records = calloc(nb_jobs, sizeof(struct record));
+  printf("%d jobs of %d work units, %d workers + %d producers on %d cores%s\n",
+         nb_jobs, work, nb_workers, nb_producers, nb_cores,
+         (nb_workers + nb_producers > nb_cores) ? " (oversubscribed)" : "");
+
+  // reference: one thread creates a task per job
+  omp_set_num_threads(nb_workers);
+  time = omp_get_wtime();
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+      for (int i = 0; i < nb_jobs; i++) {
+        records[i].submitted = omp_get_wtime();
+        #pragma omp task firstprivate(i)
+        job_short(&records[i]);
+      }
+    }
+  }
+  report("omp single + task", records, nb_jobs, omp_get_wtime() - time);
+
+  // runtime: the producers submit concurrently (the runtime is started
+  // before the measurement, as it would be in a long-running program)
+  struct runtime* rt = runtime_create(nb_workers);
+  struct group group;
+  pthread_t* threads = malloc(nb_producers * sizeof(pthread_t));
+  struct producer* producers = malloc(nb_producers * sizeof(struct producer));
+  atomic_init(&group.pending, 0);
+
+  time = omp_get_wtime();
+  for (int p = 0; p < nb_producers; p++) {
+    producers[p].rt = rt;
+    producers[p].group = &group;
+    producers[p].records = records;
+    producers[p].first = (long) nb_jobs * p / nb_producers;
+    producers[p].last = (long) nb_jobs * (p + 1) / nb_producers;
+    pthread_create(&threads[p], NULL, producer_main, &producers[p]);
+  }
+  for (int p = 0; p < nb_producers; p++)
+    pthread_join(threads[p], NULL);
+  runtime_wait(rt, &group);
+  time = omp_get_wtime() - time;
+
+  char name[64];
+  snprintf(name, sizeof(name), "runtime, %d producer%s", nb_producers,
+           nb_producers > 1 ? "s" : "");
+  report(name, records, nb_jobs, time);
+
+  runtime_destroy(rt);
+  free(threads);
+  free(producers);
+  free(records);
+  return 0;
+}
@@ -1,8 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <omp.h>
 #define NODES 5
+#define POOL_SLAB 4096          // nodes per slab of a node pool
+#define TASKS_PER_THREAD 8      // batches per thread in list_process_batched
+#define MAX_BATCH 1024          // largest batch of nodes per task
+#define BENCH_NODES 1000000     // nodes of the benchmark list (-n)
+#define BENCH_WORK 100          // work units of a benchmark job (-w)
+#define TIME_UNIT 1000          // milliseconds per unit of a timed job (-u)
 
 struct list {
   int value;
@@ -79,6 +86,287 @@ void list_process_node(struct list* node) {
  *       FUNCTION YOU HAVE TO PARALLELIZE USING OpenMP - DO TOUCH !         *
  * ------------------------------------------------------------------------ */
 
+// Node pool: nodes are carved out of slabs of POOL_SLAB contiguous
+// nodes, so building a list costs one malloc per slab instead of one per
+// node, and consecutive nodes are neighbours in memory. A pool is not
+// thread safe; its nodes are released all at once by list_pool_free (never
+// by list_free).
+struct list_slab {
+  struct list_slab* next;
+  struct list nodes[POOL_SLAB];
+};
+
+struct list_pool {
+  struct list_slab* slabs;      // last allocated slab first
+  int used;                     // nodes taken from the first slab
+};
+
+void list_pool_init(struct list_pool* pool) {
+  pool->slabs = NULL;
+  pool->used = POOL_SLAB;
+}
+
+// Return a node of the pool, initialized like list_new does.
+struct list* list_pool_new(struct list_pool* pool, int value) {
+  if (pool->used == POOL_SLAB) {
+    struct list_slab* slab = malloc(sizeof(struct list_slab));
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->used = 0;
+  }
+  struct list* new = &pool->slabs->nodes[pool->used++];
+  new->value = value;
+  new->next = NULL;
+  return new;
+}
+
+void list_pool_free(struct list_pool* pool) {
+  while (pool->slabs != NULL) {
+    struct list_slab* next = pool->slabs->next;
+    free(pool->slabs);
+    pool->slabs = next;
+  }
+  pool->used = POOL_SLAB;
+}
+
+// Same as list_init, with the nodes taken from "pool" and their "value"
+// field set to "value".
+struct list* list_init_pooled(struct list_pool* pool, int nb_nodes, int value) {
+  struct list* list = NULL, *current;
+  int i;
+
+  if (nb_nodes > 0) {
+    list = current = list_pool_new(pool, value);
+    for (i = 1; i < nb_nodes; i++) {
+      current->next = list_pool_new(pool, value);
+      current = current->next;
+    }
+  }
+  return list;
+}
+
+// Process "count" nodes from "node" on. The next node is prefetched before
+// the current one is processed, so that fetching it overlaps with the job
+// (it is written to as well, hence the write hint).
+void list_process_batch(struct list* node, int count,
+                        void (*process)(struct list*)) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    struct list* next = node->next;
+    if (next != NULL)
+      __builtin_prefetch(next, 1);
+    process(node);
+    node = next;
+  }
+}
+
+// Size of the next batch once "walked" nodes have been handed out: a
+// share of them for TASKS_PER_THREAD tasks per thread, between 1 and
+// MAX_BATCH nodes. Batches thus grow with the part of the list already
+// walked, without counting the nodes beforehand: short lists of long jobs
+// keep one task per node, the last batch of a long list is at most its
+// share of the list (load balancing).
+int list_next_batch(int walked, int nb_threads) {
+  int batch = walked / (nb_threads * TASKS_PER_THREAD);
+
+  if (batch < 1)
+    batch = 1;
+  if (batch > MAX_BATCH)
+    batch = MAX_BATCH;
+  return batch;
+}
+
+// Processing of all the list nodes with "process", one task per batch of
+// "batch" consecutive nodes ("batch" 0: growing batches, see
+// list_next_batch): the single producer only walks the list and the task
+// creation overhead is paid once per batch. The producer prefetches the
+// node after the next one, so that fetching it overlaps with the walk.
+void list_process_batched(struct list* list, int batch,
+                          void (*process)(struct list*)) {
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+      int walked = 0, size = batch;
+
+      while (list != NULL) {
+        struct list* first = list;
+        int count = 0;
+        if (batch <= 0)
+          size = list_next_batch(walked, omp_get_num_threads());
+        while (list != NULL && count < size) {
+          struct list* next = list->next;
+          if (next != NULL)
+            __builtin_prefetch(next->next);
+          list = next;
+          count++;
+        }
+        walked += count;
+        #pragma omp task firstprivate(first, count)
+        list_process_batch(first, count, process);
+      }
+    }
+  }
+}
+
+// compare function: order slabs by address (qsort)
+int compare_slabs(const void* p1, const void* p2) {
+  uintptr_t a1 = (uintptr_t) *(struct list_slab* const*) p1;
+  uintptr_t a2 = (uintptr_t) *(struct list_slab* const*) p2;
+
+  return (a1 > a2) - (a1 < a2);
+}
+
+// Index of a pool node: slab number (in address order) * POOL_SLAB +
+// offset in its slab. The slab is found by binary search.
+int list_pool_index(struct list_slab** slabs, int nb_slabs, struct list* node) {
+  int lo = 0, hi = nb_slabs - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if ((uintptr_t) slabs[mid] <= (uintptr_t) node)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo * POOL_SLAB + (int) (node - slabs[lo]->nodes);
+}
+
+// List ranking: return the nodes of "list" in list order in a new array,
+// and their number in "*nb_nodes". All the nodes of "pool" must belong to
+// "list". The pool gives random access to the nodes, so their successors
+// can be indexed in parallel; then Wyllie's pointer jumping computes the
+// distance of every node to the tail in ceil(log2 n) parallel rounds (each
+// node adds the distance of its successor and jumps to the successor's
+// successor, with double buffering), which gives its position. The work
+// is O(n log n), but every round is a flat parallel loop.
+struct list** list_rank(struct list_pool* pool, struct list* list,
+                        int* nb_nodes) {
+  struct list_slab* slab;
+  int nb_slabs = 0, size, i, s, step;
+
+  *nb_nodes = 0;
+  if (list == NULL)
+    return NULL;
+  for (slab = pool->slabs; slab != NULL; slab = slab->next)
+    nb_slabs++;
+  struct list_slab** slabs = malloc(nb_slabs * sizeof(struct list_slab*));
+  for (s = 0, slab = pool->slabs; slab != NULL; slab = slab->next)
+    slabs[s++] = slab;
+  qsort(slabs, nb_slabs, sizeof(struct list_slab*), compare_slabs);
+
+  // unused nodes of the last slab are isolated tails, skipped at the end
+  size = nb_slabs * POOL_SLAB;
+  int* succ = malloc(size * sizeof(int));
+  int* rank = malloc(size * sizeof(int));
+  int* next_succ = malloc(size * sizeof(int));
+  int* next_rank = malloc(size * sizeof(int));
+
+  #pragma omp parallel for schedule(static)
+  for (i = 0; i < size; i++) {
+    struct list_slab* own = slabs[i / POOL_SLAB];
+    struct list* node = &own->nodes[i % POOL_SLAB];
+    if ((own == pool->slabs && i % POOL_SLAB >= pool->used) ||
+        node->next == NULL) {
+      succ[i] = -1;
+      rank[i] = 0;
+    } else {
+      succ[i] = list_pool_index(slabs, nb_slabs, node->next);
+      rank[i] = 1;
+    }
+  }
+
+  for (step = 1; step < size; step *= 2) {
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < size; i++) {
+      if (succ[i] >= 0) {
+        next_rank[i] = rank[i] + rank[succ[i]];
+        next_succ[i] = succ[succ[i]];
+      } else {
+        next_rank[i] = rank[i];
+        next_succ[i] = -1;
+      }
+    }
+    int* swap = rank; rank = next_rank; next_rank = swap;
+    swap = succ; succ = next_succ; next_succ = swap;
+  }
+
+  // position of a node = distance of the head to the tail - its own
+  int head_rank = rank[list_pool_index(slabs, nb_slabs, list)];
+  struct list** order = malloc((head_rank + 1) * sizeof(struct list*));
+  #pragma omp parallel for schedule(static)
+  for (i = 0; i < size; i++) {
+    struct list_slab* own = slabs[i / POOL_SLAB];
+    if (!(own == pool->slabs && i % POOL_SLAB >= pool->used))
+      order[head_rank - rank[i]] = &own->nodes[i % POOL_SLAB];
+  }
+  *nb_nodes = head_rank + 1;
+
+  free(slabs);
+  free(succ);
+  free(rank);
+  free(next_succ);
+  free(next_rank);
+  return order;
+}
+
+// Processing of the "nb_nodes" nodes of a ranked list (see list_rank) with
+// "process", in a static parallel loop: no serial walker is left.
+void list_process_ranked(struct list** order, int nb_nodes,
+                         void (*process)(struct list*)) {
+  int i;
+
+  #pragma omp parallel for schedule(static)
+  for (i = 0; i < nb_nodes; i++)
+    process(order[i]);
+}
+
+// compare function: order list nodes by decreasing "value" (qsort)
+int compare_jobs(const void* p1, const void* p2) {
+  int v1 = (*(struct list* const*) p1)->value;
+  int v2 = (*(struct list* const*) p2)->value;
+
+  return (v1 < v2) - (v1 > v2);
+}
+
+// Lower bound of the makespan of the list's jobs ("value" time units each)
+// on the threads: max(longest job, total / threads).
+double list_lower_bound(struct list* list) {
+  double total = 0., longest = 0.;
+
+  for (; list != NULL; list = list->next) {
+    total += list->value;
+    if (list->value > longest)
+      longest = list->value;
+  }
+  total /= omp_get_max_threads();
+  return total > longest ? total : longest;
+}
+
+// Processing of all the list nodes with "process", longest job first
+// (LPT): the nodes are collected in an array sorted by decreasing
+// duration, which acts as a priority queue consumed in order: every idle
+// thread takes the longest job left. A long job found late in the list
+// cannot set the makespan anymore (LPT is within 4/3 of the optimum).
+void list_process_lpt(struct list* list, void (*process)(struct list*)) {
+  struct list* node;
+  int nb_nodes = 0, i;
+
+  for (node = list; node != NULL; node = node->next)
+    nb_nodes++;
+  struct list** jobs = malloc(nb_nodes * sizeof(struct list*));
+  for (i = 0, node = list; node != NULL; node = node->next)
+    jobs[i++] = node;
+  qsort(jobs, nb_nodes, sizeof(struct list*), compare_jobs);
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < nb_nodes; i++)
+    process(jobs[i]);
+
+  free(jobs);
+}
+
 // Processing of all the list nodes.
 void list_process(struct list* list){
 
@@ -88,15 +376,46 @@ void list_process(struct list* list){
     the while, and traverses the list, creating a task that
     processes each node separately. This decreases the processsing
     time from ~15s to ~5s (and this is the minimum, since Node 5
-    takes 5 s to process, can't go any faster than that)
+    takes 5 s to process, can't go any faster than that).
+    With millions of short jobs, one task per node makes the producer
+    the bottleneck, so nodes are handed out in growing batches instead
+    (see list_next_batch: five nodes still give five tasks).
   */
+  list_process_batched(list, 0, list_process_node);
+}
+
+/* ------------------------------------------------------------------------ *
+ *                 BENCHMARK OF MANY SHORT JOBS (WITH OPTIONS)              *
+ * ------------------------------------------------------------------------ */
+
+// Short job: "value" work units of computation instead of seconds of sleep.
+void list_process_short(struct list* node) {
+  volatile int sink = 0;
+  int i;
+
+  for (i = 0; i < node->value; i++)
+    sink += i;
+  node->value = 0;
+}
+
+// Return the number of nodes not processed yet.
+int list_unprocessed(struct list* list) {
+  int left = 0;
+
+  for (; list != NULL; list = list->next)
+    left += list->value != 0;
+  return left;
+}
+
+// One task per node, like the original list_process.
+void list_process_per_node(struct list* list, void (*process)(struct list*)) {
   #pragma omp parallel
   {
     #pragma omp single
     {
       while (list != NULL){
-        #pragma omp task
-        list_process_node(list);
+        #pragma omp task firstprivate(list)
+        process(list);
 
         list = list->next;
       }
@@ -104,11 +423,172 @@ void list_process(struct list* list){
   }
 }
 
+// Timed job: sleep "value" time units of "time_unit" milliseconds.
+int time_unit = TIME_UNIT;
+
+void list_process_timed(struct list* node) {
+  usleep(node->value * time_unit * 1000);
+  node->value = 0;
+}
+
+// Compare the makespan of the jobs of list_init("nb_nodes") (node n lasts
+// n time units, so the longest job comes last) in list order, one task
+// per node, and in LPT order, against the lower bound.
+int schedule_benchmark(int nb_nodes) {
+  struct list* list;
+  double time, bound;
+  int lpt;
+
+  printf("%d jobs on %d threads, time unit %d ms\n", nb_nodes,
+         omp_get_max_threads(), time_unit);
+  for (lpt = 0; lpt < 2; lpt++) {
+    list = list_init(nb_nodes);
+    bound = list_lower_bound(list) * time_unit / 1000.;
+    time = omp_get_wtime();
+    if (lpt)
+      list_process_lpt(list, list_process_timed);
+    else
+      list_process_per_node(list, list_process_timed);
+    time = omp_get_wtime() - time;
+    printf("%-12s makespan %8.3lf s, lower bound %8.3lf s (ratio %.3lf)\n",
+           lpt ? "LPT order" : "list order", time, bound, time / bound);
+    list_free(list);
+  }
+  return 0;
+}
+
+// Relink the nodes of "list" in a random order (Fisher-Yates, from
+// "seed") and return the new head: pooled lists are otherwise linked in
+// allocation order, which makes every node's rank its pool index.
+struct list* list_shuffle(struct list* list, unsigned int seed) {
+  struct list** nodes;
+  struct list* current;
+  int nb_nodes = 0, i;
+
+  for (current = list; current != NULL; current = current->next)
+    nb_nodes++;
+  if (nb_nodes < 2)
+    return list;
+  nodes = malloc(nb_nodes * sizeof(struct list*));
+  for (i = 0, current = list; current != NULL; current = current->next)
+    nodes[i++] = current;
+  for (i = nb_nodes - 1; i > 0; i--) {
+    int j = rand_r(&seed) % (i + 1);
+    current = nodes[i]; nodes[i] = nodes[j]; nodes[j] = current;
+  }
+  for (i = 0; i < nb_nodes - 1; i++)
+    nodes[i]->next = nodes[i + 1];
+  nodes[nb_nodes - 1]->next = NULL;
+  list = nodes[0];
+  free(nodes);
+  return list;
+}
+
+void report(const char* name, double time, int nb_nodes, struct list* list) {
+  printf("%-32s %10.6lf s %10.3lf Mjobs/s%s\n", name, time,
+         nb_nodes / time / 1e6,
+         list_unprocessed(list) ? "  [!] unprocessed nodes" : "");
+}
+
+// Compare malloc'ed and pooled lists, one task per node and batched tasks,
+// on "nb_nodes" jobs of "work" units ("batch" 0: growing batches).
+int benchmark(int nb_nodes, int work, int batch) {
+  struct list_pool pool;
+  struct list* list, *current;
+  double time;
+  int i;
+
+  // malloc'ed list, one task per node (the original pattern)
+  list = current = list_new(work);
+  for (i = 1; i < nb_nodes; i++) {
+    current->next = list_new(work);
+    current = current->next;
+  }
+  time = omp_get_wtime();
+  list_process_per_node(list, list_process_short);
+  report("malloc, task per node", omp_get_wtime() - time, nb_nodes, list);
+  list_free(list);
+
+  // pooled list, one task per node
+  list_pool_init(&pool);
+  list = list_init_pooled(&pool, nb_nodes, work);
+  time = omp_get_wtime();
+  list_process_per_node(list, list_process_short);
+  report("pool, task per node", omp_get_wtime() - time, nb_nodes, list);
+  list_pool_free(&pool);
+
+  // pooled list, batched tasks
+  list = list_init_pooled(&pool, nb_nodes, work);
+  time = omp_get_wtime();
+  list_process_batched(list, batch, list_process_short);
+  report("pool, batched tasks", omp_get_wtime() - time, nb_nodes, list);
+  list_pool_free(&pool);
+
+  // pooled list linked in a random order (so that ranks are not pool
+  // indices), ranked then processed by a static loop (the ranking is
+  // checked against a walk of the list)
+  struct list** order;
+  int nb_ranked, ranked_ok;
+  list = list_shuffle(list_init_pooled(&pool, nb_nodes, work), 12345);
+  time = omp_get_wtime();
+  order = list_rank(&pool, list, &nb_ranked);
+  double rank_time = omp_get_wtime() - time;
+  list_process_ranked(order, nb_ranked, list_process_short);
+  report("pool, ranked + static loop", omp_get_wtime() - time, nb_nodes, list);
+  ranked_ok = nb_ranked == nb_nodes;
+  for (i = 0, current = list; ranked_ok && current != NULL; current = current->next)
+    ranked_ok = order[i++] == current;
+  printf("(ranking: %.6lf s%s)\n", rank_time,
+         ranked_ok ? "" : ", [!] wrong order");
+  free(order);
+  list_pool_free(&pool);
+
+  if (batch > 0)
+    printf("(%d threads, batches of %d nodes)\n", omp_get_max_threads(), batch);
+  else
+    printf("(%d threads, growing batches of at most %d nodes)\n",
+           omp_get_max_threads(), MAX_BATCH);
+
+  return 0;
+}
+
+// Run the benchmark of many short jobs (or, with -l, the comparison of
+// scheduling orders) with the options of the command line.
+int benchmark_main(int argc, char** argv) {
+  int opt, nb_nodes = 0, work = BENCH_WORK, batch = 0, schedule = 0;
+
+  while ((opt = getopt(argc, argv, "n:w:b:lu:")) != -1) {
+    switch (opt) {
+      case 'n': nb_nodes = atoi(optarg); break;
+      case 'w': work = atoi(optarg); break;
+      case 'b': batch = atoi(optarg); break;
+      case 'l': schedule = 1; break;
+      case 'u': time_unit = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n nodes] [-w work] [-b batch]\n"
+                        "       %s -l [-n nodes] [-u time-unit-ms]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+  }
+  if (nb_nodes == 0)
+    nb_nodes = schedule ? NODES : BENCH_NODES;
+  if (nb_nodes <= 0 || work <= 0 || time_unit <= 0) {
+    fprintf(stderr, "Error: nodes, work and time unit must be positive\n");
+    return 1;
+  }
+  if (schedule)
+    return schedule_benchmark(nb_nodes);
+  return benchmark(nb_nodes, work, batch);
+}
+
 /* ------------------------------------------------------------------------ *
  *                      MAIN FUNCTION - DO NOT TOUCH                        *
  * ------------------------------------------------------------------------ */
 
-int main() {
+int main(int argc, char** argv) {
+  if (argc > 1)
+    return benchmark_main(argc, argv);
   struct list* list = list_init(NODES);
   list_print(list);
   double time = omp_get_wtime();
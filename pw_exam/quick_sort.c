@@ -1,10 +1,21 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <omp.h>
+#include "quicksort.h"
 #define MAX_VAL 5     // Random values are [0, MAX_VAL]
 #define N       1000000
 
+#define SAMPLESORT_LOG_BUCKETS 8    // Sample sort uses 2^8 buckets
+#define SAMPLESORT_OVERSAMPLING 16  // Samples taken per bucket
+#define SAMPLESORT_MIN_SIZE     4096 // Below that size, sort sequentially
+
+#define SELECT_SMALL_SIZE    16     // Selection ends with a small sort
+#define SELECT_PARALLEL_SIZE 100000 // Selection partitions in parallel above
+#define TOPK                 100    // Number of smallest elements to check
+
 /* ------------------------------------------------------------------------ *
  *      UTILITY FUNCTIONS NOT USEFUL FOR YOUR PURPOSE - DO NOT TOUCH        *
  * ------------------------------------------------------------------------ */
@@ -80,83 +91,456 @@ void quicksort_reference_driver(double* tab, size_t size) {
  *       FUNCTIONS YOU HAVE TO PARALLELIZE USING OpenMP - DO TOUCH !        *
  * ------------------------------------------------------------------------ */
 
+/*
+  partition_kernel, quicksort_kernel and quicksort_kernel_driver (the task
+  quicksort on the divide-and-conquer skeleton) are in quicksort.h, shared
+  with radix_sort.c.
+*/
+
 /**
- * quicksort_kernel function:
- * this function sorts the range of elements of the array pointed by 'tab'
- * from element with index 'low' to element with index 'high'.
- * \param     tab  Pointer to the array to (partially) sort.
- * \param[in] low  Index of the first element to sort.
- * \param[in] high Index of the last  element to sort.
+ * compare_double function:
+ * compare two double values (pointed by parameters p1 and p2), in a way
+ * compatible with C's library qsort function.
+ */
+int compare_double(const void* p1, const void* p2) {
+  double v1 = *(const double*)p1;
+  double v2 = *(const double*)p2;
+  return (v1 > v2) - (v1 < v2);
+}
+
+/**
+ * samplesort_classify function:
+ * this function returns the bucket of 'value' by walking the implicit
+ * binary search tree of splitters 'tree' (tree[1] is the root, the
+ * children of tree[j] are tree[2j] and tree[2j+1]). The comparison result
+ * is used as an index increment instead of a branch, so the loop has no
+ * hard-to-predict branch and the classification of consecutive elements
+ * can be overlapped by the processor.
+ * \param[in] tree      Splitters stored as an implicit search tree.
+ * \param[in] log_nb    Depth of the tree (log2 of the number of buckets).
+ * \param[in] value     Value to classify.
+ * \return The bucket index of 'value', in [0, 2^log_nb).
+ */
+static inline int samplesort_classify(const double tree[], int log_nb,
+                                      double value) {
+  int j = 1;
+  for (int level = 0; level < log_nb; level++)
+    j = 2 * j + (value > tree[j]);
+  return j - (1 << log_nb);
+}
+
+/**
+ * samplesort_build_tree function:
+ * this function stores the sorted splitters 'splitters[0..nb-2]' as an
+ * implicit binary search tree in 'tree[1..nb-1]' (in-order layout).
+ * \param     tree      Implicit search tree to fill.
+ * \param[in] splitters Sorted splitters.
+ * \param[in] node      Current tree node (start with 1).
+ * \param[in] low       First splitter of the subtree.
+ * \param[in] high      One past the last splitter of the subtree.
  */
-void quicksort_kernel(double tab[], int low, int high){
+static void samplesort_build_tree(double tree[], const double splitters[],
+                                  int node, int low, int high) {
   if (low < high) {
-    // 1. Partition part
-    // Take the last element as pivot, place it at its correct position
-    // with smaller elements before it and greater elements after it.
-    double pivot = tab[high];
-    int pivot_location = low;
-    double temp;
-    for (size_t j = low; j < high; j++) {
-      if (tab[j] < pivot) {
-        temp = tab[pivot_location];
-        tab[pivot_location] = tab[j];
-        tab[j] = temp;
-        pivot_location++;
+    int middle = (low + high) / 2;
+    tree[node] = splitters[middle];
+    samplesort_build_tree(tree, splitters, 2 * node, low, middle);
+    samplesort_build_tree(tree, splitters, 2 * node + 1, middle + 1, high);
+  }
+}
+
+/**
+ * samplesort_kernel_driver function:
+ * this function sorts the array of size 'size' pointed by 'tab' with a
+ * shared-memory sample sort:
+ * 1. an oversampled set of elements is sorted and 2^SAMPLESORT_LOG_BUCKETS-1
+ *    equidistant splitters are picked from it,
+ * 2. every thread classifies its own block of the array using the
+ *    branchless search tree and counts its bucket sizes,
+ * 3. a prefix sum over (bucket, thread) gives every thread its private
+ *    offset in each bucket, and all threads scatter in one parallel pass,
+ * 4. buckets are sorted independently and copied back, with a dynamic
+ *    schedule since there are many more buckets than threads.
+ * Every splitter also has an equality bucket for the elements equal to it,
+ * which needs no sort: with many duplicates, the splitters repeat the
+ * frequent values and their copies go there instead of piling up in one
+ * bucket sorted sequentially.
+ * Contrary to the recursive task quicksort, the work per thread does not
+ * depend on the pivots picked at the top of the recursion, only on the
+ * splitters which are estimated from a large sample.
+ * \param     tab  Pointer to the array to sort.
+ * \param[in] size Size of the array.
+ */
+void samplesort_kernel_driver(double* tab, size_t size) {
+  const int log_nb = SAMPLESORT_LOG_BUCKETS;
+  const int nb_buckets = 1 << log_nb;
+  const size_t nb_samples = (size_t)nb_buckets * SAMPLESORT_OVERSAMPLING;
+
+  if (size < SAMPLESORT_MIN_SIZE || size < nb_samples) {
+    qsort(tab, size, sizeof(double), compare_double);
+    return;
+  }
+
+  int nb_threads = omp_get_max_threads();
+  double* samples = malloc(nb_samples * sizeof(double));
+  double* splitters = malloc(nb_buckets * sizeof(double));
+  double* tree = malloc(nb_buckets * sizeof(double));
+  double* buffer = malloc(size * sizeof(double));
+  // bucket 2b: ]splitters[b-1], splitters[b][, bucket 2b+1: splitters[b]
+  const int nb_classes = 2 * nb_buckets;
+  unsigned short* oracle = malloc(size * sizeof(unsigned short));
+  size_t* count = malloc((size_t)nb_threads * nb_classes * sizeof(size_t));
+  size_t* bucket_start = malloc((nb_classes + 1) * sizeof(size_t));
+
+  // 1. Oversampling (pseudo-random positions, reproducible) and splitters
+  unsigned long long seed = 12345;
+  for (size_t i = 0; i < nb_samples; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    samples[i] = tab[(seed >> 17) % size];
+  }
+  qsort(samples, nb_samples, sizeof(double), compare_double);
+  for (int b = 1; b < nb_buckets; b++)
+    splitters[b - 1] = samples[b * SAMPLESORT_OVERSAMPLING];
+  samplesort_build_tree(tree, splitters, 1, 0, nb_buckets - 1);
+
+  #pragma omp parallel num_threads(nb_threads)
+  {
+    int t = omp_get_thread_num();
+    int nt = omp_get_num_threads();
+    size_t begin = size * t / nt;
+    size_t end = size * (t + 1) / nt;
+    size_t* my_count = count + (size_t)t * nb_classes;
+
+    // 2. Classification of the thread's block (the search tree gives the
+    // first bucket whose splitter is >= the element, then equality with
+    // that splitter selects its equality bucket)
+    memset(my_count, 0, nb_classes * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+      int b = samplesort_classify(tree, log_nb, tab[i]);
+      int c = 2 * b + (b < nb_buckets - 1 && tab[i] == splitters[b]);
+      oracle[i] = (unsigned short)c;
+      my_count[c]++;
+    }
+
+    #pragma omp barrier
+
+    // 3. Prefix sum over (bucket, thread), then a single parallel scatter
+    #pragma omp single
+    {
+      size_t sum = 0;
+      for (int b = 0; b < nb_classes; b++) {
+        bucket_start[b] = sum;
+        for (int u = 0; u < nt; u++) {
+          size_t c = count[(size_t)u * nb_classes + b];
+          count[(size_t)u * nb_classes + b] = sum;
+          sum += c;
+        }
       }
+      bucket_start[nb_classes] = sum;
     }
-    temp = tab[pivot_location];
-    tab[pivot_location] = tab[high];
-    tab[high] = temp;
 
-    // 2. Recursive partition part on independent subarrays
-    /*
-      This part can be done in parallel for each subarray.
-      But we need to be careful not to create threads that
-      process small subarrays - that is not efficient. We
-      created the parallel section in the driver function.
-      We check length of the subarray and only process in
-      parallel if it is greater than N / 2^p. 'p' is a parameter.
-      Quicksort recursively divides array into 2 parts, and
-      ajdusting 2's power, we can specify how many first
-      recursive iterations create tasks, while others do not.
-      I was able to get a nice speedup by setting N/16. But any
-      number starting from 2 should give a speedup.
-
-      Reference time : 0.08689 s
-      Kernel time    : 0.03082 s
-    */
-    if(high - low + 1 > N/16){
-      #pragma omp task
-      quicksort_kernel(tab, low, pivot_location - 1);
-        
-      #pragma omp task
-      quicksort_kernel(tab, pivot_location + 1, high);
+    for (size_t i = begin; i < end; i++)
+      buffer[my_count[oracle[i]]++] = tab[i];
+
+    #pragma omp barrier
+
+    // 4. Independent per-bucket sorts (equality buckets are already
+    // sorted), copied back to the input array
+    #pragma omp for schedule(dynamic, 1)
+    for (int b = 0; b < nb_classes; b++) {
+      size_t low = bucket_start[b];
+      size_t length = bucket_start[b + 1] - low;
+      if (b % 2 == 0)
+        qsort(buffer + low, length, sizeof(double), compare_double);
+      memcpy(tab + low, buffer + low, length * sizeof(double));
     }
-    else{
-      quicksort_kernel(tab, low, pivot_location - 1);
-      quicksort_kernel(tab, pivot_location + 1, high);
+  }
+
+  free(samples);
+  free(splitters);
+  free(tree);
+  free(buffer);
+  free(oracle);
+  free(count);
+  free(bucket_start);
+}
+
+/**
+ * partition_parallel function:
+ * this function is the parallel version of partition_kernel for large
+ * ranges. Every thread partitions its own block of [low, high[ with
+ * partition_kernel, then the "smaller", "equal" and "greater" parts of
+ * all the blocks are gathered in order into 'buffer' (at offsets given by
+ * a prefix sum of the part sizes) and copied back.
+ * \param     tab           Pointer to the array to partition.
+ * \param     buffer        Scratch array, at least as large as 'tab'.
+ * \param[in] low           Index of the first element of the range.
+ * \param[in] high          Index one past the last element of the range.
+ * \param[in] pivot         Pivot value.
+ * \param[out] less_end      End of the "smaller than pivot" part.
+ * \param[out] greater_begin Beginning of the "greater than pivot" part.
+ */
+void partition_parallel(double tab[], double buffer[], size_t low,
+                        size_t high, double pivot, size_t* less_end,
+                        size_t* greater_begin) {
+  int nb_threads = omp_get_max_threads();
+  size_t* bounds = malloc(3 * (size_t)nb_threads * sizeof(size_t));
+  size_t length = high - low;
+
+  #pragma omp parallel num_threads(nb_threads)
+  {
+    int t = omp_get_thread_num();
+    int nt = omp_get_num_threads();
+    size_t begin = low + length * t / nt;
+    size_t end = low + length * (t + 1) / nt;
+    size_t lt, gt;
+    size_t* my_bounds = bounds + 3 * t;
+
+    // 1. Local partition of the thread's block
+    partition_kernel(tab, begin, end, pivot, &lt, &gt);
+    my_bounds[0] = lt - begin;
+    my_bounds[1] = gt - lt;
+    my_bounds[2] = end - gt;
+
+    #pragma omp barrier
+
+    // 2. Offsets of the thread's parts in the partitioned range
+    size_t offset[3] = {low, low, low};
+    size_t total[3] = {0, 0, 0};
+    for (int u = 0; u < nt; u++) {
+      for (int part = 0; part < 3; part++) {
+        if (u < t)
+          offset[part] += bounds[3 * u + part];
+        total[part] += bounds[3 * u + part];
+      }
+    }
+    offset[1] += total[0];
+    offset[2] += total[0] + total[1];
+
+    // 3. Gather the parts, then copy the range back
+    memcpy(buffer + offset[0], tab + begin, my_bounds[0] * sizeof(double));
+    memcpy(buffer + offset[1], tab + lt, my_bounds[1] * sizeof(double));
+    memcpy(buffer + offset[2], tab + gt, my_bounds[2] * sizeof(double));
+
+    #pragma omp barrier
+
+    memcpy(tab + begin, buffer + begin, (end - begin) * sizeof(double));
+
+    if (t == 0) {
+      *less_end = low + total[0];
+      *greater_begin = low + total[0] + total[1];
     }
   }
+
+  free(bounds);
 }
 
 /**
- * quicksort_kernel_driver function:
- * this function sorts the array of size 'size' pointed by 'tab'.
- * \param     tab  Pointer to the array to sort.
+ * median_of_three function:
+ * this function returns the median of the first, middle and last elements
+ * of the range [low, high[ of the array pointed by 'tab'.
+ */
+double median_of_three(double tab[], size_t low, size_t high) {
+  double a = tab[low], b = tab[low + (high - low) / 2], c = tab[high - 1];
+  if (a < b)
+    return (b < c) ? b : ((a < c) ? c : a);
+  else
+    return (a < c) ? a : ((b < c) ? c : b);
+}
+
+/**
+ * insertion_sort function:
+ * this function sorts the range [low, high[ of the array pointed by 'tab'.
+ * It is used to finish the selection once the range is small.
+ */
+void insertion_sort(double tab[], size_t low, size_t high) {
+  for (size_t i = low + 1; i < high; i++) {
+    double value = tab[i];
+    size_t j = i;
+    while (j > low && tab[j - 1] > value) {
+      tab[j] = tab[j - 1];
+      j--;
+    }
+    tab[j] = value;
+  }
+}
+
+/**
+ * select_nth function:
+ * this function rearranges the array of size 'size' pointed by 'tab' so
+ * that tab[k] is the element that would be at index k if the array was
+ * sorted, every element before it is not greater and every element after
+ * it is not smaller (like C++'s std::nth_element). It reuses the quicksort
+ * partition step but only recurses into the side which contains k, hence
+ * an expected O(n) complexity. Ranges larger than SELECT_PARALLEL_SIZE are
+ * partitioned in parallel, ranges smaller than SELECT_SMALL_SIZE are
+ * finished with an insertion sort. 'k' must be smaller than 'size' (so
+ * the array must not be empty): otherwise the array is left untouched and
+ * NAN is returned.
+ * \param     tab  Pointer to the array.
  * \param[in] size Size of the array.
+ * \param[in] k    Rank of the element to select (0 is the smallest).
+ * \return The k-th smallest element, NAN if k >= size.
  */
-void quicksort_kernel_driver(double* tab, size_t size) {
-  /*
-    We create a parallel region here, so that we don't create and
-    destroy threads each time we enter the recursive function
-  */
-  #pragma omp parallel
-  {
-    #pragma omp single
-    {
-      quicksort_kernel(tab, 0, size - 1);
+double select_nth(double* tab, size_t size, size_t k) {
+  size_t low = 0, high = size;
+  size_t less_end, greater_begin;
+  double* buffer = NULL;
+
+  if (k >= size)
+    return NAN;
+
+  while (high - low > SELECT_SMALL_SIZE) {
+    double pivot = median_of_three(tab, low, high);
+
+    if (high - low > SELECT_PARALLEL_SIZE) {
+      if (buffer == NULL)
+        buffer = malloc(size * sizeof(double));
+      partition_parallel(tab, buffer, low, high, pivot, &less_end,
+                         &greater_begin);
     }
+    else {
+      partition_kernel(tab, low, high, pivot, &less_end, &greater_begin);
+    }
+
+    if (k < less_end)
+      high = less_end;
+    else if (k >= greater_begin)
+      low = greater_begin;
+    else
+      low = high = k; // tab[k] is equal to the pivot: done
   }
+  insertion_sort(tab, low, high);
+
+  free(buffer);
+  return tab[k];
+}
+
+/**
+ * partial_sort_topk function:
+ * this function puts the 'k' smallest elements of the array of size 'size'
+ * pointed by 'tab' in sorted order at the beginning of the array (like
+ * C++'s std::partial_sort). The remaining elements are left in an
+ * unspecified order.
+ * \param     tab  Pointer to the array.
+ * \param[in] size Size of the array.
+ * \param[in] k    Number of smallest elements to sort.
+ */
+void partial_sort_topk(double* tab, size_t size, size_t k) {
+  if (k == 0)
+    return;
+  if (k < size)
+    select_nth(tab, size, k - 1);
+  else
+    k = size;
+  qsort(tab, k, sizeof(double), compare_double);
+}
+
+/**
+ * samplesort_check_duplicates function:
+ * this function sorts 'size' values drawn among only 'nb_values' distinct
+ * ones with samplesort_kernel_driver and qsort, prints the time of both and
+ * returns 1 if the results are the same, 0 otherwise.
+ * \param[in] size      Number of values.
+ * \param[in] nb_values Number of distinct values.
+ * \return 1 if the sample sort is correct, 0 otherwise.
+ */
+int samplesort_check_duplicates(size_t size, int nb_values) {
+  double* x = malloc(size * sizeof(double));
+  double* y = malloc(size * sizeof(double));
+  double time_qsort, time_samplesort;
+  int ok = 1;
+
+  for (size_t i = 0; i < size; i++)
+    x[i] = y[i] = rand() % nb_values;
+
+  time_qsort = omp_get_wtime();
+  qsort(x, size, sizeof(double), compare_double);
+  time_qsort = omp_get_wtime() - time_qsort;
+  time_samplesort = omp_get_wtime();
+  samplesort_kernel_driver(y, size);
+  time_samplesort = omp_get_wtime() - time_samplesort;
+  printf("Duplicates (%d values): qsort %3.5lf s, samplesort %3.5lf s\n",
+         nb_values, time_qsort, time_samplesort);
+
+  for (size_t i = 0; i < size; i++)
+    if (x[i] != y[i])
+      ok = 0;
+  free(x);
+  free(y);
+  return ok;
+}
+
+/**
+ * extensions_benchmark function:
+ * this function times the sample sort, the median selection and the top-k
+ * partial sort on copies of the unsorted array of size 'size' pointed by
+ * 'tab', checks them against 'sorted' (the same values sorted), then runs
+ * the duplicate-heavy sample sort checks. 'tab' is left untouched.
+ * \param[in] tab    Pointer to the unsorted array.
+ * \param[in] sorted Pointer to the sorted array.
+ * \param[in] size   Size of the arrays.
+ * \return 1 if every result is correct, 0 otherwise.
+ */
+int extensions_benchmark(const double* tab, const double* sorted, size_t size) {
+  double* b = malloc(size * sizeof(double));
+  double* c = malloc(size * sizeof(double));
+  double* d = malloc(size * sizeof(double));
+  double time_samplesort, time_select, time_topk;
+  int ok = 1;
+
+  memcpy(b, tab, size * sizeof(double));
+  memcpy(c, tab, size * sizeof(double));
+  memcpy(d, tab, size * sizeof(double));
+
+  time_samplesort = omp_get_wtime();
+  samplesort_kernel_driver(b, size);
+  time_samplesort = omp_get_wtime() - time_samplesort;
+  printf("Samplesort time: %3.5lf s\n", time_samplesort);
+
+  // Median and top-k selection on the unsorted values
+  time_select = omp_get_wtime();
+  double median = select_nth(d, size, size / 2);
+  time_select = omp_get_wtime() - time_select;
+  printf("Select time    : %3.5lf s\n", time_select);
+
+  time_topk = omp_get_wtime();
+  partial_sort_topk(c, size, TOPK);
+  time_topk = omp_get_wtime() - time_topk;
+  printf("Top-k time     : %3.5lf s\n", time_topk);
+
+  print_sample(b, size, 5);
+  print_sample(c, TOPK, 5);
+
+  if (median != sorted[size / 2]) {
+    printf("Bad results (median) :-(((\n");
+    ok = 0;
+  }
+  for (size_t i = 0; ok && i < TOPK; i++) {
+    if (sorted[i] != c[i]) {
+      printf("Bad results (top-k) :-(((\n");
+      ok = 0;
+    }
+  }
+  for (size_t i = 0; ok && i < size; i++) {
+    if (sorted[i] != b[i]) {
+      printf("Bad results (samplesort) :-(((\n");
+      ok = 0;
+    }
+  }
+
+  // Duplicate-heavy inputs, where repeated splitters used to put most of
+  // the values into a single bucket
+  if (ok && (!samplesort_check_duplicates(size, 4) ||
+             !samplesort_check_duplicates(size, 1000))) {
+    printf("Bad results (duplicates) :-(((\n");
+    ok = 0;
+  }
+
+  free(b);
+  free(c);
+  free(d);
+  return ok;
 }
 
 /* ------------------------------------------------------------------------ *
@@ -179,6 +563,8 @@ int main() {
   quicksort_reference_driver(ref, N);
   time_reference = omp_get_wtime() - time_reference;
   printf("Reference time : %3.5lf s\n", time_reference);
+  if (!extensions_benchmark(a, ref, N))
+    exit(1);
   
   time_kernel = omp_get_wtime();
   quicksort_kernel_driver(a, N);
@@ -0,0 +1,151 @@
+/*
+  Task-parallel quicksort on the divide-and-conquer skeleton (dac.h),
+  shared by quick_sort.c and the comparison baseline of radix_sort.c.
+  partition_kernel is also the partition step of the selection in
+  quick_sort.c.
+*/
+#ifndef QUICKSORT_H
+#define QUICKSORT_H
+
+#include <stddef.h>
+#include "../openmp/dac.h"
+
+#define QUICKSORT_SMALL_SIZE 16 // Quicksort ranges below are not divided
+
+/**
+ * partition_kernel function:
+ * this function three-way partitions the range [low, high[ of the array
+ * pointed by 'tab' around 'pivot': elements smaller than the pivot are
+ * moved to [low, *less_end[, elements equal to it to
+ * [*less_end, *greater_begin[ and greater elements to [*greater_begin, high[.
+ * Keeping the equal elements together guarantees progress on inputs with
+ * many duplicates, both for sorting and for selection.
+ * \param     tab           Pointer to the array to partition.
+ * \param[in] low           Index of the first element of the range.
+ * \param[in] high          Index one past the last element of the range.
+ * \param[in] pivot         Pivot value.
+ * \param[out] less_end      End of the "smaller than pivot" part.
+ * \param[out] greater_begin Beginning of the "greater than pivot" part.
+ */
+static void partition_kernel(double tab[], size_t low, size_t high,
+                             double pivot, size_t* less_end,
+                             size_t* greater_begin) {
+  size_t lt = low, i = low, gt = high;
+  double temp;
+
+  while (i < gt) {
+    if (tab[i] < pivot) {
+      temp = tab[lt];
+      tab[lt++] = tab[i];
+      tab[i++] = temp;
+    }
+    else if (tab[i] > pivot) {
+      temp = tab[--gt];
+      tab[gt] = tab[i];
+      tab[i] = temp;
+    }
+    else {
+      i++;
+    }
+  }
+  *less_end = lt;
+  *greater_begin = gt;
+}
+
+/**
+ * quicksort_kernel function:
+ * this function sorts the range of elements of the array pointed by 'tab'
+ * from element with index 'low' to element with index 'high'.
+ * \param     tab  Pointer to the array to (partially) sort.
+ * \param[in] low  Index of the first element to sort.
+ * \param[in] high Index of the last  element to sort.
+ */
+static void quicksort_kernel(double tab[], int low, int high){
+  if (low < high) {
+    // 1. Partition part
+    // Take the last element as pivot, place the elements equal to it at
+    // their correct position with smaller elements before them and greater
+    // elements after them.
+    size_t less_end, greater_begin;
+    partition_kernel(tab, low, high + 1, tab[high], &less_end, &greater_begin);
+    int pivot_first = (int)less_end;
+    int pivot_last = (int)greater_begin - 1;
+
+    // 2. Recursive partition part on independent subarrays (sequential,
+    // the tasks are created by the skeleton, see quicksort_divide)
+    quicksort_kernel(tab, low, pivot_first - 1);
+    quicksort_kernel(tab, pivot_last + 1, high);
+  }
+}
+
+/*
+  The parallel quicksort runs on the divide-and-conquer skeleton: a range
+  is divided by partitioning it around its last element, the two sides
+  being the subproblems. Partitions are unbalanced, so the cutoff is
+  load-based (new tasks only while few of them are pending) instead of the
+  former fixed N/16 size threshold, which tuned the task count to N and
+  ignored both the number of threads and the shape of the recursion.
+*/
+struct quicksort_problem {
+  double* tab;
+  int low;
+  int high;
+};
+
+/**
+ * quicksort_divide function:
+ * this function partitions the range of the quicksort_problem 'problem'
+ * and stores its two sides as quicksort_problems in 'children'.
+ * \param     problem  Range to divide.
+ * \param[out] children Subranges to sort.
+ * \return    Number of subranges, 0 if the range is too small to divide.
+ */
+static int quicksort_divide(void* problem, void* children) {
+  struct quicksort_problem* p = problem;
+  struct quicksort_problem* c = children;
+  size_t less_end, greater_begin;
+
+  if (p->high - p->low + 1 < QUICKSORT_SMALL_SIZE)
+    return 0;
+  partition_kernel(p->tab, p->low, p->high + 1, p->tab[p->high], &less_end,
+                   &greater_begin);
+  c[0].tab = c[1].tab = p->tab;
+  c[0].low = p->low;
+  c[0].high = (int)less_end - 1;
+  c[1].low = (int)greater_begin;
+  c[1].high = p->high;
+  return 2;
+}
+
+/**
+ * quicksort_solve function:
+ * this function sorts the range of the quicksort_problem 'problem'
+ * sequentially.
+ * \param problem Range to sort.
+ */
+static void quicksort_solve(void* problem) {
+  struct quicksort_problem* p = problem;
+
+  quicksort_kernel(p->tab, p->low, p->high);
+}
+
+static const struct dac_ops quicksort_ops = {
+  sizeof(struct quicksort_problem), quicksort_divide, NULL, quicksort_solve,
+  NULL
+};
+
+/**
+ * quicksort_kernel_driver function:
+ * this function sorts the array of size 'size' pointed by 'tab'.
+ * \param     tab  Pointer to the array to sort.
+ * \param[in] size Size of the array.
+ */
+static void quicksort_kernel_driver(double* tab, size_t size) {
+  struct quicksort_problem problem = {tab, 0, (int)size - 1};
+  struct dac dac;
+
+  dac_init(&dac, &quicksort_ops, DAC_CUTOFF_LOAD);
+  dac_run(&dac, &problem);
+}
+
+#endif
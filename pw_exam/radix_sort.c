@@ -0,0 +1,377 @@
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "quicksort.h"
+
+#define N          10000000 // Size of the arrays to sort
+#define RADIX_BITS 8        // Number of key bits handled by one pass
+#define RADIX      (1 << RADIX_BITS)
+#define WC_LINE    8        // Keys per write-combining buffer (one cache line)
+
+/* ------------------------------------------------------------------------ *
+ *                         KEY TRANSFORMATIONS                              *
+ * ------------------------------------------------------------------------ */
+
+/**
+ * double_to_key function:
+ * this function maps an IEEE-754 double to an unsigned 64-bit integer so
+ * that the unsigned order of the keys is the numeric order of the doubles.
+ * Positive numbers get their sign bit set, negative numbers are bitwise
+ * inverted (so that a larger magnitude gives a smaller key).
+ * \param[in] value The double to transform.
+ * \return The order-preserving key.
+ */
+uint64_t double_to_key(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (bits & 0x8000000000000000ULL) ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+/**
+ * key_to_double function:
+ * this function is the inverse of double_to_key.
+ * \param[in] key The key to transform back.
+ * \return The original double.
+ */
+double key_to_double(uint64_t key) {
+  double value;
+  key = (key & 0x8000000000000000ULL) ? key & 0x7fffffffffffffffULL : ~key;
+  memcpy(&value, &key, sizeof(value));
+  return value;
+}
+
+/**
+ * int_to_key function:
+ * this function maps a signed int to an unsigned key by flipping the sign
+ * bit, so that negative numbers come before positive ones.
+ * \param[in] value The int to transform.
+ * \return The order-preserving key.
+ */
+uint64_t int_to_key(int value) {
+  return (uint32_t) value ^ 0x80000000U;
+}
+
+/**
+ * key_to_int function:
+ * this function is the inverse of int_to_key.
+ * \param[in] key The key to transform back.
+ * \return The original int.
+ */
+int key_to_int(uint64_t key) {
+  return (int) ((uint32_t) key ^ 0x80000000U);
+}
+
+/* ------------------------------------------------------------------------ *
+ *                         PARALLEL RADIX SORT ENGINE                       *
+ * ------------------------------------------------------------------------ */
+
+/**
+ * radix_sort_keys function:
+ * this function sorts 'size' unsigned 64-bit keys with a parallel LSD radix
+ * sort, optionally moving a 64-bit payload along with every key. Each pass
+ * works as follows:
+ * - every thread builds the digit histogram of its own contiguous block,
+ * - a prefix sum over (digit, thread) gives every thread its private
+ *   output offset for every digit, which keeps the sort stable,
+ * - every thread scatters its block through small write-combining buffers
+ *   (one cache line per digit), so that the output is written by full
+ *   lines instead of scattered single words.
+ * Passes where all the keys share the same digit are skipped, and only the
+ * 'key_bits' lower bits of the keys are sorted (the others must be 0).
+ * \param     keys     Pointer to the keys to sort.
+ * \param     values   Pointer to the payload to permute, or NULL.
+ * \param[in] size     Number of keys.
+ * \param[in] key_bits Number of significant key bits (at most 64).
+ */
+void radix_sort_keys(uint64_t* keys, uint64_t* values, size_t size,
+                     int key_bits) {
+  int nb_threads = omp_get_max_threads();
+  uint64_t* keys_tmp = malloc(size * sizeof(uint64_t));
+  uint64_t* values_tmp = (values != NULL) ? malloc(size * sizeof(uint64_t)) : NULL;
+  size_t* count = malloc((size_t) nb_threads * RADIX * sizeof(size_t));
+  uint64_t* src_keys = keys, *dst_keys = keys_tmp;
+  uint64_t* src_values = values, *dst_values = values_tmp;
+  int skip;
+
+  for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+    skip = 0;
+
+    #pragma omp parallel num_threads(nb_threads)
+    {
+      int t = omp_get_thread_num();
+      int nt = omp_get_num_threads();
+      size_t begin = size * t / nt;
+      size_t end = size * (t + 1) / nt;
+      size_t* my_count = count + (size_t) t * RADIX;
+      size_t offset[RADIX];
+      uint64_t wc_keys[RADIX][WC_LINE];
+      uint64_t wc_values[RADIX][WC_LINE];
+      int wc_fill[RADIX];
+
+      // 1. Per-thread histogram
+      memset(my_count, 0, RADIX * sizeof(size_t));
+      for (size_t i = begin; i < end; i++)
+        my_count[(src_keys[i] >> shift) & (RADIX - 1)]++;
+
+      #pragma omp barrier
+
+      // 2. Prefix sum over (digit, thread), done once by a single thread
+      #pragma omp single
+      {
+        size_t sum = 0;
+        for (int d = 0; d < RADIX; d++) {
+          size_t digit_total = 0;
+          for (int u = 0; u < nt; u++) {
+            size_t c = count[(size_t) u * RADIX + d];
+            count[(size_t) u * RADIX + d] = sum;
+            sum += c;
+            digit_total += c;
+          }
+          if (digit_total == size)
+            skip = 1;
+        }
+      }
+
+      // 3. Scatter through the write-combining buffers
+      if (!skip) {
+        memcpy(offset, my_count, sizeof(offset));
+        memset(wc_fill, 0, sizeof(wc_fill));
+        for (size_t i = begin; i < end; i++) {
+          uint64_t key = src_keys[i];
+          int d = (key >> shift) & (RADIX - 1);
+          int f = wc_fill[d];
+          wc_keys[d][f] = key;
+          if (src_values != NULL)
+            wc_values[d][f] = src_values[i];
+          if (++f == WC_LINE) {
+            memcpy(dst_keys + offset[d], wc_keys[d], sizeof(wc_keys[d]));
+            if (src_values != NULL)
+              memcpy(dst_values + offset[d], wc_values[d], sizeof(wc_values[d]));
+            offset[d] += WC_LINE;
+            f = 0;
+          }
+          wc_fill[d] = f;
+        }
+        for (int d = 0; d < RADIX; d++) {
+          memcpy(dst_keys + offset[d], wc_keys[d], wc_fill[d] * sizeof(uint64_t));
+          if (src_values != NULL)
+            memcpy(dst_values + offset[d], wc_values[d],
+                   wc_fill[d] * sizeof(uint64_t));
+        }
+      }
+    }
+
+    if (!skip) {
+      uint64_t* temp;
+      temp = src_keys; src_keys = dst_keys; dst_keys = temp;
+      temp = src_values; src_values = dst_values; dst_values = temp;
+    }
+  }
+
+  // After an odd number of passes the result is in the scratch buffers
+  if (src_keys != keys) {
+    memcpy(keys, src_keys, size * sizeof(uint64_t));
+    if (values != NULL)
+      memcpy(values, src_values, size * sizeof(uint64_t));
+  }
+
+  free(keys_tmp);
+  free(values_tmp);
+  free(count);
+}
+
+/**
+ * radix_sort_double function:
+ * this function sorts the array of size 'size' pointed by 'tab'.
+ * \param     tab  Pointer to the array to sort.
+ * \param[in] size Size of the array.
+ */
+void radix_sort_double(double* tab, size_t size) {
+  uint64_t* keys = malloc(size * sizeof(uint64_t));
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    keys[i] = double_to_key(tab[i]);
+
+  radix_sort_keys(keys, NULL, size, 64);
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    tab[i] = key_to_double(keys[i]);
+
+  free(keys);
+}
+
+/**
+ * radix_sort_int function:
+ * this function sorts the array of size 'size' pointed by 'tab'. The keys
+ * only use their 32 lower bits, so only the 4 lower digits are sorted: the
+ * 4 upper digits are neither counted nor scattered.
+ * \param     tab  Pointer to the array to sort.
+ * \param[in] size Size of the array.
+ */
+void radix_sort_int(int* tab, size_t size) {
+  uint64_t* keys = malloc(size * sizeof(uint64_t));
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    keys[i] = int_to_key(tab[i]);
+
+  radix_sort_keys(keys, NULL, size, 32);
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    tab[i] = key_to_int(keys[i]);
+
+  free(keys);
+}
+
+/**
+ * radix_sort_double_kv function:
+ * this function sorts the array of size 'size' pointed by 'tab' and applies
+ * the same permutation to the payload array 'values' (e.g. the original
+ * indices, to get an argsort). The sort is stable.
+ * \param     tab    Pointer to the array to sort.
+ * \param     values Pointer to the payload array.
+ * \param[in] size   Size of the arrays.
+ */
+void radix_sort_double_kv(double* tab, uint64_t* values, size_t size) {
+  uint64_t* keys = malloc(size * sizeof(uint64_t));
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    keys[i] = double_to_key(tab[i]);
+
+  radix_sort_keys(keys, values, size, 64);
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < size; i++)
+    tab[i] = key_to_double(keys[i]);
+
+  free(keys);
+}
+
+/* ------------------------------------------------------------------------ *
+ *                         COMPARISON SORTS (BASELINES)                     *
+ * ------------------------------------------------------------------------ */
+
+// The task-parallel quicksort of quick_sort.c is in quicksort.h
+
+/**
+ * compare_double function:
+ * compare two double values (pointed by parameters p1 and p2), in a way
+ * compatible with C's library qsort function.
+ */
+int compare_double(const void* p1, const void* p2) {
+  double v1 = *(const double*) p1;
+  double v2 = *(const double*) p2;
+  return (v1 > v2) - (v1 < v2);
+}
+
+/**
+ * compare_int function:
+ * compare two int values (pointed by parameters p1 and p2), in a way
+ * compatible with C's library qsort function.
+ */
+int compare_int(const void* p1, const void* p2) {
+  int v1 = *(const int*) p1;
+  int v2 = *(const int*) p2;
+  return (v1 > v2) - (v1 < v2);
+}
+
+/* ------------------------------------------------------------------------ *
+ *                               MAIN FUNCTION                              *
+ * ------------------------------------------------------------------------ */
+
+int main() {
+  double* a     = malloc(N * sizeof(double));
+  double* ref   = malloc(N * sizeof(double));
+  double* quick = malloc(N * sizeof(double));
+  double* orig  = malloc(N * sizeof(double));
+  int* ia       = malloc(N * sizeof(int));
+  int* iref     = malloc(N * sizeof(int));
+  uint64_t* idx = malloc(N * sizeof(uint64_t));
+  double time_qsort, time_quick, time_radix;
+
+  // Initialization by random values of both signs and large magnitudes
+  srand((unsigned int)time(NULL));
+  for (size_t i = 0; i < N; i++) {
+    double mantissa = (double)rand() / RAND_MAX - 0.5;
+    a[i] = mantissa * (double)(1 << (rand() % 30));
+    ref[i] = quick[i] = orig[i] = a[i];
+    ia[i] = iref[i] = rand() - RAND_MAX / 2;
+    idx[i] = i;
+  }
+
+  printf("Doubles (%d elements):\n", N);
+  time_qsort = omp_get_wtime();
+  qsort(ref, N, sizeof(double), compare_double);
+  time_qsort = omp_get_wtime() - time_qsort;
+  printf("qsort time     : %3.5lf s\n", time_qsort);
+
+  time_quick = omp_get_wtime();
+  quicksort_kernel_driver(quick, N);
+  time_quick = omp_get_wtime() - time_quick;
+  printf("Quicksort time : %3.5lf s\n", time_quick);
+
+  time_radix = omp_get_wtime();
+  radix_sort_double(a, N);
+  time_radix = omp_get_wtime() - time_radix;
+  printf("Radix time     : %3.5lf s\n", time_radix);
+  printf("Speedup        : %3.2lf (qsort), %3.2lf (quicksort)\n",
+         time_qsort / time_radix, time_quick / time_radix);
+
+  for (size_t i = 0; i < N; i++) {
+    if (ref[i] != a[i] || ref[i] != quick[i]) {
+      printf("Bad results (doubles) :-(((\n");
+      exit(1);
+    }
+  }
+
+  printf("Ints (%d elements):\n", N);
+  time_qsort = omp_get_wtime();
+  qsort(iref, N, sizeof(int), compare_int);
+  time_qsort = omp_get_wtime() - time_qsort;
+  printf("qsort time     : %3.5lf s\n", time_qsort);
+
+  time_radix = omp_get_wtime();
+  radix_sort_int(ia, N);
+  time_radix = omp_get_wtime() - time_radix;
+  printf("Radix time     : %3.5lf s\n", time_radix);
+  printf("Speedup        : %3.2lf (qsort)\n", time_qsort / time_radix);
+
+  for (size_t i = 0; i < N; i++) {
+    if (iref[i] != ia[i]) {
+      printf("Bad results (ints) :-(((\n");
+      exit(1);
+    }
+  }
+
+  printf("Key/value (%d elements):\n", N);
+  memcpy(a, orig, N * sizeof(double));
+  time_radix = omp_get_wtime();
+  radix_sort_double_kv(a, idx, N);
+  time_radix = omp_get_wtime() - time_radix;
+  printf("Radix time     : %3.5lf s\n", time_radix);
+
+  for (size_t i = 0; i < N; i++) {
+    if (ref[i] != a[i] || orig[idx[i]] != a[i] ||
+        (i > 0 && a[i] == a[i-1] && idx[i] < idx[i-1])) {
+      printf("Bad results (key/value) :-(((\n");
+      exit(1);
+    }
+  }
+  printf("OK results :-)\n");
+
+  free(a);
+  free(ref);
+  free(quick);
+  free(orig);
+  free(ia);
+  free(iref);
+  free(idx);
+  return 0;
+}